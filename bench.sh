@@ -0,0 +1,17 @@
+#!/bin/sh
+# builds the benchmarks (posix only, no raylib library needed) and runs them
+# with the given arguments, e.g. ./bench.sh --baseline bench.txt
+
+mkdir -p ./build
+
+gcc \
+    -o ./build/bench \
+    ./src/bench.c \
+    -O2 \
+    -std=c99 \
+    -Wall \
+    -I./raylib/include/ \
+    -lm \
+    -lpthread || { echo "compilation of bench failed"; exit 1; }
+
+./build/bench "$@"
@@ -0,0 +1,19 @@
+#!/bin/sh
+# builds the crowd check with more creatures than one job plans (posix only,
+# no raylib library needed) and runs it with the given arguments,
+# e.g. ./crowd.sh --turns 2000
+
+mkdir -p ./build
+
+gcc \
+    -o ./build/crowd \
+    ./src/crowd.c \
+    -DCREATURE_CAPACITY=512 \
+    -O2 \
+    -std=c99 \
+    -Wall \
+    -I./raylib/include/ \
+    -lm \
+    -lpthread || { echo "compilation of crowd failed"; exit 1; }
+
+./build/crowd "$@"
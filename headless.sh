@@ -0,0 +1,17 @@
+#!/bin/sh
+# builds the windowless renderer (software backend, no raylib library needed)
+# and runs it with the given arguments, e.g. ./headless.sh --seed 8 --out frame.png
+
+mkdir -p ./build
+
+gcc \
+    -o ./build/headless \
+    ./src/headless.c \
+    -O2 \
+    -std=c99 \
+    -Wall \
+    -I./raylib/include/ \
+    -lm \
+    -lpthread || { echo "compilation of headless failed"; exit 1; }
+
+./build/headless "$@"
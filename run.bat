@@ -5,6 +5,8 @@ set D="-g -DDEBUG"
 set GDB=0
 
 set DEBUG=""
+set PROFILE=""
+set TRACE=""
 
 for %%x in (%*) do (
     if "%%x"=="-help" (
@@ -16,16 +18,26 @@ for %%x in (%*) do (
     ) else if "%%x"=="d" (
         set DEBUG=%D%
         echo DEBUG is enabled
+    ) else if "%%x"=="p" (
+        set PROFILE="-DPROFILE"
+        echo PROFILE is enabled
+    ) else if "%%x"=="t" (
+        set TRACE="-DTRACE"
+        echo TRACE is enabled
     ) else (
         set PROGRAM="%%x"
     )
 )
 
 set DEBUG=%DEBUG:"=%
+set PROFILE=%PROFILE:"=%
+set TRACE=%TRACE:"=%
 set VERBOSE=%VERBOSE:"=%
 
 gcc ^
     !DEBUG! ^
+    !PROFILE! ^
+    !TRACE! ^
     -o ./build/g.exe ^
     ./src/main.c ^
     -O0 ^
@@ -36,7 +48,8 @@ gcc ^
     -lraylib ^
     -lopengl32 ^
     -lgdi32 ^
-    -lwinmm
+    -lwinmm ^
+    -lpthread
 
 if not %errorlevel% equ 0 (
     echo compilation of g.exe failed
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+
+// the simulation thread only pays for copying what changed since its
+// previous autosave, a few chunks around the player on most turns. encoding,
+// writing and syncing the file happen on the save thread
+
+// copies the chunks of the grid whose version differs from versions into
+// grid, all of them when all is set, and brings versions up to date
+void copy_changed_chunks(State *state, uint8 (*grid)[GRID_HEIGHT], uint32 *versions, bool all) {
+    for (int chunk = 0; chunk < CHUNK_AMOUNT; chunk++) {
+        if (!all && versions[chunk] == state->chunk_versions[chunk]) {
+            continue;
+        }
+        versions[chunk] = state->chunk_versions[chunk];
+        int x0 = (chunk % CHUNK_COLUMNS) * CHUNK_SIZE;
+        int y0 = (chunk / CHUNK_COLUMNS) * CHUNK_SIZE;
+        for (int x = x0; x < x0 + CHUNK_SIZE; x++) {
+            memcpy(&grid[x][y0], &state->grid[x][y0], CHUNK_SIZE);
+        }
+    }
+}
+
+// copies the chunks the grid changed since the previous capture, all of them
+// the first time
+static void capture_grid_chunks(State *state, Autosave *a) {
+    copy_changed_chunks(state, a->snapshot->grid, a->chunk_versions, !a->captured);
+    a->captured = true;
+}
+
+static bool write_autosave(Autosave *a) {
+    FILE *file = fopen(a->temp_path, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = write_level(file, a->snapshot) && sync_file(file);
+    ok = (fclose(file) == 0) && ok;
+    if (ok) {
+        ok = replace_file(a->temp_path, a->path);
+    }
+    if (!ok) {
+        remove(a->temp_path);
+    }
+    return ok;
+}
+
+static void *autosave_main(void *arg) {
+    Autosave *a = (Autosave *)arg;
+    TRACE_THREAD("autosave");
+    pthread_mutex_lock(&a->mutex);
+    while (true) {
+        while (!a->quit && !a->busy) {
+            pthread_cond_wait(&a->wake, &a->mutex);
+        }
+        if (!a->busy) {
+            break;
+        }
+        pthread_mutex_unlock(&a->mutex);
+        TRACE_BEGIN("write autosave");
+        bool ok = write_autosave(a);
+        TRACE_END("write autosave");
+        pthread_mutex_lock(&a->mutex);
+        a->busy = false;
+        a->failed = a->failed || !ok;
+        a->saves += ok;
+        pthread_cond_broadcast(&a->wake);
+    }
+    pthread_mutex_unlock(&a->mutex);
+    return 0;
+}
+
+// a world game is written back through its mapping already, autosaves are
+// for games that live only in memory. false when path is too long
+bool autosave_start(State *state, const char *path) {
+    Autosave *a = &state->autosave;
+    if (state->world.open || strlen(path) + 5 > AUTOSAVE_PATH_CAPACITY) {
+        return false;
+    }
+    strcpy(a->path, path);
+    strcpy(a->temp_path, path);
+    strcat(a->temp_path, ".tmp");
+    a->snapshot = (Level *)malloc(sizeof(Level));
+    a->captured = false;
+    a->quit = false;
+    a->busy = false;
+    a->failed = false;
+    a->last_turn = state->turn;
+    a->turns = 0;
+    a->saves = 0;
+    a->max_capture_ms = 0.0;
+    pthread_mutex_init(&a->mutex, 0);
+    pthread_cond_init(&a->wake, 0);
+    pthread_create(&a->thread, 0, autosave_main, a);
+    a->running = true;
+    return true;
+}
+
+// takes the snapshot and wakes the save thread, called between turns by
+// whichever thread runs them
+static void autosave_now(State *state) {
+    Autosave *a = &state->autosave;
+    TRACE_BEGIN("capture autosave");
+    double start = get_time_ms();
+    capture_level_state(state, a->snapshot);
+    capture_grid_chunks(state, a);
+    a->capture_ms = get_time_ms() - start;
+    TRACE_END("capture autosave");
+    if (a->capture_ms > a->max_capture_ms) {
+        a->max_capture_ms = a->capture_ms;
+    }
+    a->turns = 0;
+
+    pthread_mutex_lock(&a->mutex);
+    a->busy = true;
+    pthread_cond_signal(&a->wake);
+    pthread_mutex_unlock(&a->mutex);
+}
+
+// counts turns, undone ones too, and autosaves once AUTOSAVE_INTERVAL passed
+void autosave_turn(State *state) {
+    Autosave *a = &state->autosave;
+    if (!a->running || state->turn == a->last_turn) {
+        return;
+    }
+    a->last_turn = state->turn;
+    if (++a->turns < AUTOSAVE_INTERVAL) {
+        return;
+    }
+    pthread_mutex_lock(&a->mutex);
+    bool busy = a->busy;
+    pthread_mutex_unlock(&a->mutex);
+    if (!busy) {
+        autosave_now(state);
+    }
+}
+
+// waits for a save in progress, saves once more when turns were played since,
+// and stops the thread. false when any save failed
+bool autosave_stop(State *state) {
+    Autosave *a = &state->autosave;
+    if (!a->running) {
+        return true;
+    }
+    pthread_mutex_lock(&a->mutex);
+    while (a->busy) {
+        pthread_cond_wait(&a->wake, &a->mutex);
+    }
+    pthread_mutex_unlock(&a->mutex);
+    if (a->turns > 0) {
+        autosave_now(state);
+    }
+    pthread_mutex_lock(&a->mutex);
+    a->quit = true;
+    pthread_cond_broadcast(&a->wake);
+    pthread_mutex_unlock(&a->mutex);
+    pthread_join(a->thread, 0);
+    pthread_cond_destroy(&a->wake);
+    pthread_mutex_destroy(&a->mutex);
+    free(a->snapshot);
+    a->snapshot = 0;
+    a->running = false;
+    return !a->failed;
+}
@@ -0,0 +1,114 @@
+#include "../raylib/include/raylib.h"
+#include "main.h"
+
+static struct {
+    bool scene_loaded;
+    RenderTexture2D scene;
+    bool image_used[GFX_IMAGE_CAPACITY];
+    Texture2D images[GFX_IMAGE_CAPACITY];
+} gfx;
+
+int gfx_screen_width(void) {
+    return GetScreenWidth();
+}
+
+int gfx_screen_height(void) {
+    return GetScreenHeight();
+}
+
+// the scene is drawn into a render texture that is presented on every frame
+// until the renderer decides it is out of date
+void gfx_begin_scene(void) {
+    if (!gfx.scene_loaded) {
+        gfx.scene = LoadRenderTexture(GetScreenWidth(), GetScreenHeight());
+        gfx.scene_loaded = true;
+    }
+    BeginTextureMode(gfx.scene);
+}
+
+void gfx_end_scene(void) {
+    EndTextureMode();
+}
+
+// what is drawn between these goes on top of the scene without changing it
+void gfx_begin_present(void) {
+    BeginDrawing();
+    if (gfx.scene_loaded) {
+        Rectangle source = { 0, 0, gfx.scene.texture.width, -gfx.scene.texture.height };
+        DrawTextureRec(gfx.scene.texture, source, (Vector2) { 0, 0 }, WHITE);
+    }
+}
+
+void gfx_end_present(void) {
+    EndDrawing();
+}
+
+void gfx_unload_scene(void) {
+    if (gfx.scene_loaded) {
+        UnloadRenderTexture(gfx.scene);
+        gfx.scene_loaded = false;
+    }
+}
+
+void gfx_clear(Color color) {
+    COUNT_WORK(DRAW_CALLS, 1);
+    ClearBackground(color);
+}
+
+void gfx_rect(Rectangle rec, Color color) {
+    COUNT_WORK(DRAW_CALLS, 1);
+    DrawRectangleRec(rec, color);
+}
+
+void gfx_text(const char *text, int x, int y, int size, Color color) {
+    COUNT_WORK(DRAW_CALLS, 1);
+    DrawText(text, x, y, size, color);
+}
+
+int gfx_load_image(int width, int height, Color color) {
+    for (int i = 0; i < GFX_IMAGE_CAPACITY; i++) {
+        if (!gfx.image_used[i]) {
+            Image image = GenImageColor(width, height, color);
+            gfx.images[i] = LoadTextureFromImage(image);
+            UnloadImage(image);
+            gfx.image_used[i] = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void gfx_update_image(int image, Rectangle region, const Color *pixels) {
+    if (image < 0) {
+        return;
+    }
+    UpdateTextureRec(gfx.images[image], region, pixels);
+}
+
+void gfx_draw_image(int image, Rectangle source, Rectangle dest) {
+    COUNT_WORK(DRAW_CALLS, 1);
+    if (image < 0) {
+        return;
+    }
+    DrawTexturePro(gfx.images[image], source, dest, (Vector2) { 0, 0 }, 0.0f, WHITE);
+}
+
+// consecutive quads from one texture end up in a single raylib batch, so the
+// whole list costs one draw call
+void gfx_draw_image_batch(int image, const Rectangle *sources, const Rectangle *dests, int count) {
+    COUNT_WORK(DRAW_CALLS, 1);
+    if (image < 0) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        DrawTexturePro(gfx.images[image], sources[i], dests[i], (Vector2) { 0, 0 }, 0.0f, WHITE);
+    }
+}
+
+void gfx_unload_image(int image) {
+    if (image < 0 || !gfx.image_used[image]) {
+        return;
+    }
+    UnloadTexture(gfx.images[image]);
+    gfx.image_used[image] = false;
+}
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+
+// every gfx_* call rasterizes into an in-memory scene canvas, so frames can be
+// written to disk, compared against golden images and timed without a window
+// or a gpu
+
+static struct {
+    Canvas scene;
+    uint32 presented;
+    bool image_used[GFX_IMAGE_CAPACITY];
+    Canvas images[GFX_IMAGE_CAPACITY];
+} software;
+
+void software_init(int width, int height) {
+    software.scene = load_canvas(width, height, BLANK);
+    software.presented = 0;
+}
+
+void software_deinit(void) {
+    for (int i = 0; i < GFX_IMAGE_CAPACITY; i++) {
+        gfx_unload_image(i);
+    }
+    unload_canvas(&software.scene);
+}
+
+Color *software_pixels(void) {
+    return software.scene.pixels;
+}
+
+int gfx_screen_width(void) {
+    return software.scene.width;
+}
+
+int gfx_screen_height(void) {
+    return software.scene.height;
+}
+
+// drawing always goes straight into the scene canvas so there is nothing to
+// switch between, presenting only counts frames
+void gfx_begin_scene(void) {
+}
+
+void gfx_end_scene(void) {
+}
+
+// there is no screen apart from the scene, so nothing can go on top of it
+void gfx_begin_present(void) {
+}
+
+void gfx_end_present(void) {
+    software.presented++;
+}
+
+void gfx_unload_scene(void) {
+}
+
+void gfx_clear(Color color) {
+    COUNT_WORK(DRAW_CALLS, 1);
+    raster_clear(&software.scene, color);
+}
+
+void gfx_rect(Rectangle rec, Color color) {
+    COUNT_WORK(DRAW_CALLS, 1);
+    raster_rect(&software.scene, rec, color);
+}
+
+// there is no font, text is left out
+void gfx_text(const char *text, int x, int y, int size, Color color) {
+    COUNT_WORK(DRAW_CALLS, 1);
+}
+
+int gfx_load_image(int width, int height, Color color) {
+    for (int i = 0; i < GFX_IMAGE_CAPACITY; i++) {
+        if (!software.image_used[i]) {
+            software.images[i] = load_canvas(width, height, color);
+            software.image_used[i] = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void gfx_update_image(int image, Rectangle region, const Color *pixels) {
+    if (image < 0) {
+        return;
+    }
+    Canvas *target = &software.images[image];
+    int width = region.width;
+    for (int y = 0; y < (int)region.height; y++) {
+        Color *row = &target->pixels[(int)region.x + (((int)region.y + y) * target->width)];
+        memcpy(row, &pixels[y * width], width * sizeof(Color));
+    }
+}
+
+void gfx_draw_image(int image, Rectangle source, Rectangle dest) {
+    COUNT_WORK(DRAW_CALLS, 1);
+    if (image < 0) {
+        return;
+    }
+    raster_canvas(&software.scene, &software.images[image], source, dest);
+}
+
+void gfx_draw_image_batch(int image, const Rectangle *sources, const Rectangle *dests, int count) {
+    COUNT_WORK(DRAW_CALLS, 1);
+    if (image < 0) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        raster_canvas(&software.scene, &software.images[image], sources[i], dests[i]);
+    }
+}
+
+void gfx_unload_image(int image) {
+    if (image < 0 || !software.image_used[image]) {
+        return;
+    }
+    unload_canvas(&software.images[image]);
+    software.image_used[image] = false;
+}
+
+bool software_write_ppm(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", software.scene.width, software.scene.height);
+    for (int i = 0; i < software.scene.width * software.scene.height; i++) {
+        Color c = software.scene.pixels[i];
+        uint8 rgb[3] = { c.r, c.g, c.b };
+        fwrite(rgb, 1, 3, file);
+    }
+    return fclose(file) == 0;
+}
+
+static uint32 crc_table[256];
+
+static uint32 update_crc(uint32 crc, const uint8 *data, int length) {
+    if (crc_table[1] == 0) {
+        for (uint32 n = 0; n < 256; n++) {
+            uint32 c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            crc_table[n] = c;
+        }
+    }
+    for (int i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void write_be32(FILE *file, uint32 value) {
+    uint8 bytes[4] = { value >> 24, value >> 16, value >> 8, value };
+    fwrite(bytes, 1, 4, file);
+}
+
+static void write_png_chunk(FILE *file, const char *type, const uint8 *data, int length) {
+    write_be32(file, length);
+    fwrite(type, 1, 4, file);
+    fwrite(data, 1, length, file);
+    uint32 crc = update_crc(0xffffffffu, (const uint8 *)type, 4);
+    crc = update_crc(crc, data, length);
+    write_be32(file, crc ^ 0xffffffffu);
+}
+
+// rgb png with the image data in uncompressed deflate blocks, big but small
+// enough to write and readable by any viewer
+bool software_write_png(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    int stride = 1 + (software.scene.width * 3);
+    int raw_length = stride * software.scene.height;
+    int block_count = (raw_length + 65534) / 65535;
+    int zlib_length = 2 + (block_count * 5) + raw_length + 4;
+    uint8 *raw = (uint8 *)malloc(raw_length);
+    uint8 *zlib = (uint8 *)malloc(zlib_length);
+
+    for (int y = 0; y < software.scene.height; y++) {
+        uint8 *row = &raw[y * stride];
+        row[0] = 0;
+        for (int x = 0; x < software.scene.width; x++) {
+            Color c = software.scene.pixels[x + (y * software.scene.width)];
+            row[1 + (x * 3)] = c.r;
+            row[2 + (x * 3)] = c.g;
+            row[3 + (x * 3)] = c.b;
+        }
+    }
+
+    uint32 adler_a = 1;
+    uint32 adler_b = 0;
+    for (int i = 0; i < raw_length; i++) {
+        adler_a = (adler_a + raw[i]) % 65521;
+        adler_b = (adler_b + adler_a) % 65521;
+    }
+
+    int at = 0;
+    zlib[at++] = 0x78;
+    zlib[at++] = 0x01;
+    for (int offset = 0; offset < raw_length; offset += 65535) {
+        int length = (raw_length - offset < 65535) ? raw_length - offset : 65535;
+        zlib[at++] = (offset + length == raw_length) ? 1 : 0;
+        zlib[at++] = length & 0xff;
+        zlib[at++] = length >> 8;
+        zlib[at++] = ~length & 0xff;
+        zlib[at++] = (~length >> 8) & 0xff;
+        memcpy(&zlib[at], &raw[offset], length);
+        at += length;
+    }
+    uint32 adler = (adler_b << 16) | adler_a;
+    zlib[at++] = adler >> 24;
+    zlib[at++] = adler >> 16;
+    zlib[at++] = adler >> 8;
+    zlib[at++] = adler;
+
+    uint8 header[13] = {
+        software.scene.width >> 24, software.scene.width >> 16, software.scene.width >> 8, software.scene.width,
+        software.scene.height >> 24, software.scene.height >> 16, software.scene.height >> 8, software.scene.height,
+        8, 2, 0, 0, 0,
+    };
+    const uint8 signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    fwrite(signature, 1, 8, file);
+    write_png_chunk(file, "IHDR", header, 13);
+    write_png_chunk(file, "IDAT", zlib, at);
+    write_png_chunk(file, "IEND", 0, 0);
+
+    free(raw);
+    free(zlib);
+    return fclose(file) == 0;
+}
+
+// returns the number of pixels that differ from a ppm written by
+// software_write_ppm, or -1 when the file is missing or has another size
+int software_compare_ppm(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    int width, height, max_value;
+    if (fscanf(file, "P6 %d %d %d", &width, &height, &max_value) != 3 ||
+        width != software.scene.width || height != software.scene.height || max_value != 255
+    ) {
+        fclose(file);
+        return -1;
+    }
+    fgetc(file);
+    int different = 0;
+    for (int i = 0; i < width * height; i++) {
+        uint8 rgb[3];
+        if (fread(rgb, 1, 3, file) != 3) {
+            fclose(file);
+            return -1;
+        }
+        Color c = software.scene.pixels[i];
+        if (rgb[0] != c.r || rgb[1] != c.g || rgb[2] != c.b) {
+            different++;
+        }
+    }
+    fclose(file);
+    return different;
+}
@@ -0,0 +1,442 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "main.h"
+#include "map.c"
+#include "vision.c"
+#include "movement.c"
+#include "jobs.c"
+#include "schedule.c"
+#include "cooperative.c"
+#include "creatures.c"
+#include "undo.c"
+#include "hash.c"
+#include "game.c"
+#include "level.c"
+#include "levels.c"
+#include "platform.c"
+#include "profile.c"
+#include "trace.c"
+#include "work.c"
+#include "world.c"
+#include "autosave.c"
+#include "replay.c"
+#include "sim.c"
+
+// times the hot paths of the simulation on fixed seeds and fixed queries, so
+// two runs on the same machine do the same work. a sample times a batch of
+// calls after an untimed warm-up batch, and the suite runs BENCH_RUNS times.
+// the report keeps the run with the lowest median of each benchmark, with its
+// throughput and latency percentiles per call
+//
+//   bench                                  runs everything and prints the table
+//   bench --save base.txt                  also writes the results as a baseline
+//   bench --baseline base.txt              compares against it, exit 1 on a regression
+//   bench --baseline base.txt --threshold 5
+
+#define BENCH_SEEDS 4
+#define BENCH_DEPTHS 8
+#define BENCH_SHORT_QUERIES 64
+#define BENCH_LONG_QUERIES 16
+#define BENCH_UNREACHABLE_QUERIES 4
+#define BENCH_SHORT_DISTANCE 8
+#define BENCH_LONG_DISTANCE 64
+#define BENCH_SAMPLES 16
+#define BENCH_BATCH 16
+#define BENCH_QUERY_REPEATS 8
+#define BENCH_TURN_BATCH 8
+#define BENCH_RUNS 9
+#define BENCH_NAME_CAPACITY 32
+
+static const uint32 bench_seeds[BENCH_SEEDS] = { 8, 3, 1234, 99991 };
+
+typedef enum BenchKind {
+    BENCH_GENERATE_LEVEL,
+    BENCH_ASTAR_SHORT,
+    BENCH_ASTAR_LONG,
+    BENCH_ASTAR_UNREACHABLE,
+    BENCH_DISCOVER_VISIBLE_CELLS,
+    BENCH_SET_INVISIBLE,
+    BENCH_UPDATE_CREATURES,
+    BENCH_RUN_TURN,
+    BENCH_COUNT,
+} BenchKind;
+
+static const char *bench_names[BENCH_COUNT] = {
+    [BENCH_GENERATE_LEVEL] = "generate_level",
+    [BENCH_ASTAR_SHORT] = "astar_short",
+    [BENCH_ASTAR_LONG] = "astar_long",
+    [BENCH_ASTAR_UNREACHABLE] = "astar_unreachable",
+    [BENCH_DISCOVER_VISIBLE_CELLS] = "discover_visible_cells",
+    [BENCH_SET_INVISIBLE] = "set_invisible",
+    [BENCH_UPDATE_CREATURES] = "update_creatures",
+    [BENCH_RUN_TURN] = "run_turn",
+};
+
+// ms holds the time per call of every sample
+typedef struct BenchSamples {
+    int count;
+    int capacity;
+    int calls;
+    double total_ms;
+    double *ms;
+} BenchSamples;
+
+typedef struct BenchResult {
+    int count;
+    double ops_per_second;
+    double p50_us;
+    double p90_us;
+    double p99_us;
+    double max_us;
+} BenchResult;
+
+typedef struct BenchQuery {
+    Cell start;
+    Cell goal;
+} BenchQuery;
+
+static BenchSamples bench_samples[BENCH_COUNT];
+
+// ms is the time of the whole batch of calls
+static void add_sample(BenchKind kind, double ms, int calls) {
+    BenchSamples *s = &bench_samples[kind];
+    if (s->count == s->capacity) {
+        s->capacity = (s->capacity > 0) ? s->capacity * 2 : 64;
+        s->ms = (double *)realloc(s->ms, s->capacity * sizeof(double));
+    }
+    s->ms[s->count++] = ms / calls;
+    s->calls += calls;
+    s->total_ms += ms;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static BenchResult get_bench_result(BenchKind kind) {
+    BenchSamples *s = &bench_samples[kind];
+    BenchResult result = { .count = s->calls };
+    if (s->count == 0) {
+        return result;
+    }
+    qsort(s->ms, s->count, sizeof(double), compare_doubles);
+    result.ops_per_second = (s->total_ms > 0.0) ? (s->calls * 1000.0) / s->total_ms : 0.0;
+    result.p50_us = s->ms[((s->count - 1) * 50) / 100] * 1000.0;
+    result.p90_us = s->ms[((s->count - 1) * 90) / 100] * 1000.0;
+    result.p99_us = s->ms[((s->count - 1) * 99) / 100] * 1000.0;
+    result.max_us = s->ms[s->count - 1] * 1000.0;
+    return result;
+}
+
+static Cell random_walkable_cell(State *state, uint32 *random) {
+    while (true) {
+        Cell cell = { random_range(random, 0, GRID_WIDTH - 1), random_range(random, 0, GRID_HEIGHT - 1) };
+        if (has_flag(state->grid[cell.x][cell.y], CELL_FLAG_WALKABLE)) {
+            return cell;
+        }
+    }
+}
+
+static Cell random_wall_cell(State *state, uint32 *random) {
+    while (true) {
+        Cell cell = { random_range(random, 0, GRID_WIDTH - 1), random_range(random, 0, GRID_HEIGHT - 1) };
+        if (!has_flag(state->grid[cell.x][cell.y], CELL_FLAG_WALKABLE)) {
+            return cell;
+        }
+    }
+}
+
+static bool is_reachable(State *state, Cell start, Cell goal) {
+    astar_path(state, start, goal, CELL_FLAG_CREATURE_WALKABLE, ASTAR_SITE_CHASE);
+    return state->a_star.path_length > 0;
+}
+
+// picks the queries from the seed before anything is timed. short ones end
+// within BENCH_SHORT_DISTANCE cells, long ones start at least
+// BENCH_LONG_DISTANCE apart, unreachable ones end in rock so the search
+// floods everything it can reach
+static void pick_queries(State *state, uint32 seed, BenchQuery *short_queries, BenchQuery *long_queries, BenchQuery *unreachable_queries) {
+    uint32 random = (uint32)hash_pair(seed, 0x62656e63, 0) | 1;
+    for (int i = 0; i < BENCH_SHORT_QUERIES; i++) {
+        BenchQuery q;
+        do {
+            q.start = random_walkable_cell(state, &random);
+            q.goal = (Cell) {
+                q.start.x + random_range(&random, -BENCH_SHORT_DISTANCE, BENCH_SHORT_DISTANCE),
+                q.start.y + random_range(&random, -BENCH_SHORT_DISTANCE, BENCH_SHORT_DISTANCE),
+            };
+        } while (
+            is_cell_out_of_bounds(state, q.goal) ||
+            cell_eq(q.start, q.goal) ||
+            !has_flag(state->grid[q.goal.x][q.goal.y], CELL_FLAG_WALKABLE) ||
+            !is_reachable(state, q.start, q.goal)
+        );
+        short_queries[i] = q;
+    }
+    for (int i = 0; i < BENCH_LONG_QUERIES; i++) {
+        BenchQuery q;
+        do {
+            q.start = random_walkable_cell(state, &random);
+            q.goal = random_walkable_cell(state, &random);
+        } while (manhattan_distance(q.start, q.goal) < BENCH_LONG_DISTANCE || !is_reachable(state, q.start, q.goal));
+        long_queries[i] = q;
+    }
+    for (int i = 0; i < BENCH_UNREACHABLE_QUERIES; i++) {
+        unreachable_queries[i] = (BenchQuery) {
+            random_walkable_cell(state, &random),
+            random_wall_cell(state, &random),
+        };
+    }
+}
+
+// every query is one sample of BENCH_QUERY_REPEATS searches, after one
+// untimed search
+static void time_queries(State *state, BenchKind kind, BenchQuery *queries, int count) {
+    for (int i = 0; i < count; i++) {
+        astar_path(state, queries[i].start, queries[i].goal, CELL_FLAG_CREATURE_WALKABLE, ASTAR_SITE_CHASE);
+        double start = get_time_ms();
+        for (int repeat = 0; repeat < BENCH_QUERY_REPEATS; repeat++) {
+            astar_path(state, queries[i].start, queries[i].goal, CELL_FLAG_CREATURE_WALKABLE, ASTAR_SITE_CHASE);
+        }
+        add_sample(kind, get_time_ms() - start, BENCH_QUERY_REPEATS);
+    }
+}
+
+// a level takes long enough to be a sample on its own
+static void bench_generate_level(uint32 seed) {
+    LevelGen *gen = (LevelGen *)calloc(1, sizeof(LevelGen));
+    gen->grid = (Grid)malloc(GRID_BYTES);
+    generate_level(gen, seed, 0);
+    for (int depth = 0; depth < BENCH_DEPTHS; depth++) {
+        double start = get_time_ms();
+        generate_level(gen, seed, depth);
+        add_sample(BENCH_GENERATE_LEVEL, get_time_ms() - start, 1);
+    }
+    free(gen->grid);
+    free(gen);
+}
+
+static void bench_astar(uint32 seed, int worker_count) {
+    State *state = (State *)calloc(1, sizeof(State));
+    init_game(state, seed, worker_count);
+    BenchQuery short_queries[BENCH_SHORT_QUERIES];
+    BenchQuery long_queries[BENCH_LONG_QUERIES];
+    BenchQuery unreachable_queries[BENCH_UNREACHABLE_QUERIES];
+    pick_queries(state, seed, short_queries, long_queries, unreachable_queries);
+    time_queries(state, BENCH_ASTAR_SHORT, short_queries, BENCH_SHORT_QUERIES);
+    time_queries(state, BENCH_ASTAR_LONG, long_queries, BENCH_LONG_QUERIES);
+    time_queries(state, BENCH_ASTAR_UNREACHABLE, unreachable_queries, BENCH_UNREACHABLE_QUERIES);
+    deinit_game(state);
+    free(state);
+}
+
+// vision and the creatures run on the level as generated, the creatures keep
+// going from where the previous call left them
+static void bench_simulation(uint32 seed, int worker_count) {
+    State *state = (State *)calloc(1, sizeof(State));
+    init_game(state, seed, worker_count);
+    for (int sample = -1; sample < BENCH_SAMPLES; sample++) {
+        double start = get_time_ms();
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            set_invisible(state);
+        }
+        double middle = get_time_ms();
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            discover_visible_cells(state);
+        }
+        if (sample >= 0) {
+            add_sample(BENCH_SET_INVISIBLE, middle - start, BENCH_BATCH);
+            add_sample(BENCH_DISCOVER_VISIBLE_CELLS, get_time_ms() - middle, BENCH_BATCH);
+        }
+    }
+    int cost = creature_action_cost(state->player.type);
+    for (int sample = -1; sample < BENCH_SAMPLES; sample++) {
+        double start = get_time_ms();
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            update_creatures(state, cost);
+        }
+        if (sample >= 0) {
+            add_sample(BENCH_UPDATE_CREATURES, get_time_ms() - start, BENCH_BATCH);
+        }
+    }
+    deinit_game(state);
+    free(state);
+}
+
+// a discovered walkable cell in the viewport, the player's position when the
+// draws find none
+static Cell pick_walk_target(State *state, uint32 *random) {
+    for (int i = 0; i < 64; i++) {
+        Cell cell = {
+            state->game_offset.x + random_range(random, 0, GAME_WIDTH - 1),
+            state->game_offset.y + random_range(random, 0, GAME_HEIGHT - 1),
+        };
+        if (!is_cell_out_of_bounds(state, cell) && has_flag(state->grid[cell.x][cell.y], CELL_FLAG_PLAYER_WALKABLE)) {
+            return cell;
+        }
+    }
+    return state->player.position;
+}
+
+// the player walks to random cells in view like workload's explore scenario,
+// so a turn includes the player's path, vision, the stairs and the creatures
+static void bench_turns(uint32 seed, int worker_count) {
+    State *state = (State *)calloc(1, sizeof(State));
+    init_game(state, seed, worker_count);
+    uint32 random = seed | 1;
+    for (int sample = -1; sample < BENCH_SAMPLES; sample++) {
+        double start = get_time_ms();
+        for (int i = 0; i < BENCH_TURN_BATCH; i++) {
+            hide_unseen_creatures(state);
+            SimCommand command = { .action = TURN_ACTION_CONTINUE };
+            if (!has_flag(state->flags, GAME_FLAG_IS_MOVING)) {
+                command.action = TURN_ACTION_CLICK;
+                command.target = pick_walk_target(state, &random);
+            }
+            run_turn(state, &command);
+        }
+        if (sample >= 0) {
+            add_sample(BENCH_RUN_TURN, get_time_ms() - start, BENCH_TURN_BATCH);
+        }
+    }
+    deinit_game(state);
+    free(state);
+}
+
+static bool save_baseline(const char *path, BenchResult *results) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "# name p50_us p99_us ops_per_second\n");
+    for (int kind = 0; kind < BENCH_COUNT; kind++) {
+        fprintf(file, "%s %.3f %.3f %.1f\n",
+            bench_names[kind], results[kind].p50_us, results[kind].p99_us, results[kind].ops_per_second
+        );
+    }
+    return fclose(file) == 0;
+}
+
+// a benchmark regressed when its median got slower than the baseline by more
+// than threshold percent. the 99th percentile is shown but too noisy to judge
+static int compare_baseline(const char *path, BenchResult *results, double threshold) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    int regressions = 0;
+    char line[256];
+    printf("\n%-22s %10s %10s %8s\n", "against baseline", "p50 us", "now us", "change");
+    while (fgets(line, sizeof(line), file)) {
+        char name[BENCH_NAME_CAPACITY];
+        double p50_us, p99_us, ops;
+        if (line[0] == '#' || sscanf(line, "%31s %lf %lf %lf", name, &p50_us, &p99_us, &ops) != 4) {
+            continue;
+        }
+        for (int kind = 0; kind < BENCH_COUNT; kind++) {
+            if (strcmp(name, bench_names[kind]) != 0) {
+                continue;
+            }
+            double change = (p50_us > 0.0) ? ((results[kind].p50_us / p50_us) - 1.0) * 100.0 : 0.0;
+            bool regressed = change > threshold;
+            regressions += regressed;
+            printf("%-22s %10.2f %10.2f %+7.1f%%%s\n",
+                name, p50_us, results[kind].p50_us, change, regressed ? "  REGRESSED" : ""
+            );
+        }
+    }
+    fclose(file);
+    return regressions;
+}
+
+static void usage(void) {
+    printf(
+        "usage: bench [options]\n"
+        "  --save FILE      write the results as a baseline\n"
+        "  --baseline FILE  compare the medians against a saved baseline,\n"
+        "                   exit 1 when one got slower than the threshold\n"
+        "  --threshold PCT  allowed slowdown in percent (default 10)\n"
+        "  --workers N      threads for the creatures (default %d)\n",
+        WORKER_COUNT
+    );
+}
+
+int main(int argc, char **argv) {
+    const char *save_path = 0;
+    const char *baseline_path = 0;
+    double threshold = 10.0;
+    int worker_count = WORKER_COUNT;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--save") == 0 && has_value) {
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && has_value) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && has_value) {
+            threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && has_value) {
+            worker_count = atoi(argv[++i]);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    init_movement_tables();
+    BenchResult results[BENCH_COUNT];
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        for (int kind = 0; kind < BENCH_COUNT; kind++) {
+            bench_samples[kind].count = 0;
+            bench_samples[kind].calls = 0;
+            bench_samples[kind].total_ms = 0.0;
+        }
+        for (int i = 0; i < BENCH_SEEDS; i++) {
+            uint32 seed = bench_seeds[i];
+            bench_generate_level(seed);
+            bench_astar(seed, worker_count);
+            bench_simulation(seed, worker_count);
+            bench_turns(seed, worker_count);
+        }
+        for (int kind = 0; kind < BENCH_COUNT; kind++) {
+            BenchResult r = get_bench_result(kind);
+            if (run == 0 || r.p50_us < results[kind].p50_us) {
+                results[kind] = r;
+            }
+        }
+    }
+
+    printf("%-22s %6s %12s %10s %10s %10s %10s\n", "benchmark", "calls", "calls/s", "p50 us", "p90 us", "p99 us", "max us");
+    for (int kind = 0; kind < BENCH_COUNT; kind++) {
+        BenchResult *r = &results[kind];
+        printf("%-22s %6d %12.1f %10.2f %10.2f %10.2f %10.2f\n",
+            bench_names[kind], r->count, r->ops_per_second, r->p50_us, r->p90_us, r->p99_us, r->max_us
+        );
+    }
+
+    int result = 0;
+    if (save_path && !save_baseline(save_path, results)) {
+        printf("could not write %s\n", save_path);
+        result = 2;
+    }
+    if (baseline_path) {
+        int regressions = compare_baseline(baseline_path, results, threshold);
+        if (regressions < 0) {
+            printf("could not read %s\n", baseline_path);
+            result = 2;
+        } else if (regressions > 0) {
+            printf("%d of %d benchmarks regressed by more than %.1f%%\n", regressions, BENCH_COUNT, threshold);
+            result = 1;
+        }
+    }
+    for (int kind = 0; kind < BENCH_COUNT; kind++) {
+        free(bench_samples[kind].ms);
+    }
+    return result;
+}
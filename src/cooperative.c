@@ -0,0 +1,348 @@
+#include <string.h>
+#include "main.h"
+
+static inline uint32 reservation_key(Cell cell) {
+    return (uint32)(cell.x + (cell.y * GRID_WIDTH)) + 1;
+}
+
+static ReservationLayer *get_reservation_layer(State *state, uint32 time, bool recycle) {
+    ReservationLayer *layer = &state->reservations[time % RESERVATION_LAYERS];
+    if (layer->time != time) {
+        if (!recycle) {
+            return 0;
+        }
+        memset(layer->cells, 0, sizeof(layer->cells));
+        layer->time = time;
+    }
+    return layer;
+}
+
+int get_reservation(State *state, Cell cell, uint32 layer_time) {
+    ReservationLayer *layer = get_reservation_layer(state, layer_time, false);
+    if (!layer) {
+        return NO_CREATURE;
+    }
+    uint32 key = reservation_key(cell);
+    for (int i = 0; i < RESERVATION_LAYER_CAPACITY; i++) {
+        int slot = (key + i) & (RESERVATION_LAYER_CAPACITY - 1);
+        if (layer->cells[slot] == 0) {
+            return NO_CREATURE;
+        }
+        if (layer->cells[slot] == key) {
+            return layer->owners[slot];
+        }
+    }
+    return NO_CREATURE;
+}
+
+// changes the owner of a reservation only if it is currently held by previous
+static void set_reservation(State *state, Cell cell, uint32 layer_time, int owner, int previous) {
+    ReservationLayer *layer = get_reservation_layer(state, layer_time, owner != NO_CREATURE);
+    if (!layer) {
+        return;
+    }
+    uint32 key = reservation_key(cell);
+    for (int i = 0; i < RESERVATION_LAYER_CAPACITY; i++) {
+        int slot = (key + i) & (RESERVATION_LAYER_CAPACITY - 1);
+        if (layer->cells[slot] == 0) {
+            if (previous == NO_CREATURE) {
+                layer->cells[slot] = key;
+                layer->owners[slot] = owner;
+            }
+            return;
+        }
+        if (layer->cells[slot] == key) {
+            if (layer->owners[slot] == previous) {
+                layer->owners[slot] = owner;
+            }
+            return;
+        }
+    }
+}
+
+// layers touched by the action interval [start, start + cost)
+static inline uint32 first_layer(uint32 start) {
+    return start / ACTION_COST;
+}
+
+static inline uint32 last_layer(uint32 start, int cost) {
+    return (start + cost - 1) / ACTION_COST;
+}
+
+static bool is_reserved_by_other(State *state, Cell cell, uint32 start, int cost, int self) {
+    for (uint32 t = first_layer(start); t <= last_layer(start, cost); t++) {
+        int owner = get_reservation(state, cell, t);
+        if (owner != NO_CREATURE && owner != self) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void reserve_path(State *state, CooperativePath *path, int owner, int previous) {
+    for (int k = 0; k < path->length; k++) {
+        uint32 start = path->start_time + (k * path->cost);
+        for (uint32 t = first_layer(start); t <= last_layer(start, path->cost); t++) {
+            set_reservation(state, path->cells[k], t, owner, previous);
+        }
+    }
+}
+
+void release_cooperative_path(State *state, int idx) {
+    CooperativePath *path = &state->paths[idx];
+    reserve_path(state, path, NO_CREATURE, idx);
+    path->length = 0;
+    path->step = 0;
+}
+
+// drops every plan and cached distance field, needed whenever the map changes
+void reset_cooperative_paths(State *state) {
+    for (int i = 0; i < RESERVATION_LAYERS; i++) {
+        memset(state->reservations[i].cells, 0, sizeof(state->reservations[i].cells));
+    }
+    for (int i = 0; i < CREATURE_CAPACITY; i++) {
+        state->paths[i].length = 0;
+        state->paths[i].step = 0;
+    }
+    state->space_time.distance_goal = INVALID_CELL;
+}
+
+// true walking distance to the goal ignoring other creatures, used as the
+// heuristic so a window that ends before the goal still heads the right way.
+// chasers mostly share a goal so the last field is kept until the goal changes
+static void compute_goal_distance(State *state, SpaceTimeSearch *st, Cell goal, int walkable_flags) {
+    if (cell_eq(st->distance_goal, goal)) {
+        return;
+    }
+    st->distance_goal = goal;
+    for (int x = 0; x < GRID_WIDTH; x++) {
+        for (int y = 0; y < GRID_HEIGHT; y++) {
+            st->distance[x][y] = INT_MAX;
+        }
+    }
+    int head = 0;
+    int tail = 0;
+    st->distance[goal.x][goal.y] = 0;
+    st->queue[tail++] = goal;
+    while (head < tail) {
+        Cell cell = st->queue[head++];
+        int distance = st->distance[cell.x][cell.y] + 1;
+        for (int i = 0; i < 4; i++) {
+            Cell n = get_cell_in_direction(cell, i, 1);
+            if (is_cell_valid(state, n, walkable_flags) && st->distance[n.x][n.y] == INT_MAX) {
+                st->distance[n.x][n.y] = distance;
+                st->queue[tail++] = n;
+            }
+        }
+    }
+    COUNT_WORK(BFS_CELLS, tail);
+}
+
+static inline bool space_time_less(SpaceTimeSearch *st, int a, int b) {
+    SpaceTimeNode *na = &st->nodes[a];
+    SpaceTimeNode *nb = &st->nodes[b];
+    if (na->f_cost != nb->f_cost) {
+        return na->f_cost < nb->f_cost;
+    }
+    return na->step > nb->step;
+}
+
+static void space_time_push(SpaceTimeSearch *st, int node) {
+    int i = st->open_count++;
+    st->open[i] = node;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!space_time_less(st, st->open[i], st->open[parent])) {
+            break;
+        }
+        int tmp = st->open[i];
+        st->open[i] = st->open[parent];
+        st->open[parent] = tmp;
+        i = parent;
+    }
+}
+
+static int space_time_pop(SpaceTimeSearch *st) {
+    int top = st->open[0];
+    st->open_count--;
+    st->open[0] = st->open[st->open_count];
+    int i = 0;
+    while (true) {
+        int smallest = i;
+        int left = (i * 2) + 1;
+        int right = left + 1;
+        if (left < st->open_count && space_time_less(st, st->open[left], st->open[smallest])) {
+            smallest = left;
+        }
+        if (right < st->open_count && space_time_less(st, st->open[right], st->open[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        int tmp = st->open[i];
+        st->open[i] = st->open[smallest];
+        st->open[smallest] = tmp;
+        i = smallest;
+    }
+    return top;
+}
+
+// false once the nodes are used up. cells the distance field does not reach
+// cannot lead to the goal and are skipped
+static bool space_time_add(SpaceTimeSearch *st, Cell position, int step, int came_from) {
+    if (st->distance[position.x][position.y] == INT_MAX) {
+        return true;
+    }
+    if (st->node_count == SPACE_TIME_NODE_CAPACITY) {
+        return false;
+    }
+    int idx = st->node_count++;
+    st->nodes[idx] = (SpaceTimeNode) {
+        .position = position,
+        .step = step,
+        .f_cost = step + st->distance[position.x][position.y],
+        .came_from = came_from,
+    };
+    st->visited_steps[position.x][position.y] |= (1u << step);
+    space_time_push(st, idx);
+    return true;
+}
+
+// windowed space-time A*: plans at most RESERVATION_WINDOW actions, waiting in
+// place is allowed and cells reserved by other creatures are avoided
+bool plan_cooperative_path(State *state, int idx, Cell goal) {
+    SpaceTimeSearch *st = &state->space_time;
+    Creature *c = &state->creatures[idx];
+    CooperativePath *path = &state->paths[idx];
+    int cost = creature_action_cost(c->type);
+    uint32 start_time = state->schedule.now;
+
+    release_cooperative_path(state, idx);
+
+    compute_goal_distance(state, st, goal, CELL_FLAG_CREATURE_WALKABLE);
+    if (st->distance[c->position.x][c->position.y] == INT_MAX || cell_eq(c->position, goal)) {
+        return false;
+    }
+
+    memset(st->visited_steps, 0, sizeof(st->visited_steps));
+    st->node_count = 0;
+    st->open_count = 0;
+    space_time_add(st, c->position, 0, -1);
+
+    int best = 0;
+    while (st->open_count > 0) {
+        int current_idx = space_time_pop(st);
+        SpaceTimeNode current = st->nodes[current_idx];
+        if (cell_eq(current.position, goal) || current.step == RESERVATION_WINDOW) {
+            best = current_idx;
+            break;
+        }
+        SpaceTimeNode *best_node = &st->nodes[best];
+        if (st->distance[current.position.x][current.position.y] < st->distance[best_node->position.x][best_node->position.y]) {
+            best = current_idx;
+        }
+
+        int step = current.step + 1;
+        uint32 interval = start_time + ((step - 1) * cost);
+        for (int i = 0; i < 5; i++) {
+            Cell n = (i < 4) ? get_cell_in_direction(current.position, i, 1) : current.position;
+            if (!is_cell_valid(state, n, CELL_FLAG_CREATURE_WALKABLE) ||
+                has_flag(st->visited_steps[n.x][n.y], 1u << step) ||
+                is_reserved_by_other(state, n, interval, cost, idx)
+            ) {
+                continue;
+            }
+            bool occupied = (
+                step == 1 && cell_neq(n, c->position) &&
+                has_flag(state->grid[n.x][n.y], CELL_FLAG_CREATURE)
+            );
+            if (occupied) {
+                continue;
+            }
+            if (step > 1) {
+                int other = get_reservation(state, n, first_layer(interval - cost));
+                bool swap = (
+                    other != NO_CREATURE && other != idx &&
+                    get_reservation(state, current.position, first_layer(interval)) == other
+                );
+                if (swap) {
+                    continue;
+                }
+            }
+            if (!space_time_add(st, n, step, current_idx)) {
+                break;
+            }
+        }
+    }
+
+    // every node is pushed once, the ones left in the heap were never expanded
+    COUNT_WORK(ASTAR_EXPANSIONS, st->node_count - st->open_count);
+
+    int length = st->nodes[best].step;
+    if (length == 0) {
+        return false;
+    }
+    for (int node = best; st->nodes[node].step > 0; node = st->nodes[node].came_from) {
+        path->cells[st->nodes[node].step - 1] = st->nodes[node].position;
+    }
+    path->goal = goal;
+    path->start_time = start_time;
+    path->cost = cost;
+    path->length = length;
+    path->step = 0;
+    reserve_path(state, path, idx, NO_CREATURE);
+    return true;
+}
+
+static inline bool needs_cooperative_path(State *state, int idx) {
+    Creature *c = &state->creatures[idx];
+    CooperativePath *path = &state->paths[idx];
+    if (c->type != CREATURE_BIG_EVIL_TRIANGLE || cell_eq(c->last_known_player_location, INVALID_CELL)) {
+        return false;
+    }
+    return (
+        path->step >= path->length ||
+        path->step >= (RESERVATION_WINDOW / 2) ||
+        cell_neq(path->goal, c->last_known_player_location) ||
+        manhattan_distance(path->cells[path->step], c->position) > 1
+    );
+}
+
+// replans the chasers acting this tick one after another in creature order,
+// so lower indices get first pick of the corridor and later ones plan around them
+void plan_cooperative_paths(State *state) {
+    int order[CREATURE_CAPACITY];
+    int count = 0;
+    for (int i = 0; i < state->active_count; i++) {
+        if (state->active[i].tier != SIM_TIER_FULL) {
+            continue;
+        }
+        int idx = state->active[i].index;
+        if (!needs_cooperative_path(state, idx)) {
+            continue;
+        }
+        int j = count++;
+        while (j > 0 && order[j - 1] > idx) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = idx;
+    }
+    for (int i = 0; i < count; i++) {
+        plan_cooperative_path(state, order[i], state->creatures[order[i]].last_known_player_location);
+    }
+}
+
+// called by the resolve step once the creature's move was committed or rejected
+void advance_cooperative_path(State *state, int idx, bool committed) {
+    CooperativePath *path = &state->paths[idx];
+    if (path->step >= path->length) {
+        return;
+    }
+    if (committed && cell_neq(state->creatures[idx].last_known_player_location, INVALID_CELL)) {
+        path->step++;
+    } else {
+        release_cooperative_path(state, idx);
+    }
+}
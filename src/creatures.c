@@ -0,0 +1,400 @@
+#include "main.h"
+
+void update_creature_direction(Creature *c) {
+    if (c->previous_position.y > c->position.y) {
+        c->direction = ORTHAGONAL_N;
+    } else if (c->previous_position.x > c->position.x) {
+        c->direction = ORTHAGONAL_W;
+    } else if (c->previous_position.y < c->position.y) {
+        c->direction = ORTHAGONAL_S;
+    } else if (c->previous_position.x < c->position.x) {
+        c->direction = ORTHAGONAL_E;
+    }
+}
+
+// phase one: reads only the grid and the current creatures, writes only into next
+void plan_creature(State *state, AStar *a, CooperativePath *path, Creature *c, Creature *next) {
+    *next = *c;
+    next->previous_position = c->position;
+    Cell old_pos = c->position;
+    Cell new_pos = old_pos;
+    switch (c->type) {
+    case CREATURE_DIGGER: {
+        new_pos = random_wander(state, old_pos, next->direction, &next->random);
+    } break;
+    case CREATURE_EVIL_TRIANGLE: {
+        CoordAndDirection cad = bounce_path(state, old_pos, next->direction);
+        new_pos = cad.coord;
+        next->direction = cad.direction;
+    } break;
+    case CREATURE_BIG_EVIL_TRIANGLE: {
+        bool waiting = false;
+        if (cell_neq(next->last_known_player_location, INVALID_CELL)) {
+            bool planned = (
+                path->step < path->length &&
+                cell_eq(path->goal, next->last_known_player_location) &&
+                manhattan_distance(path->cells[path->step], old_pos) <= 1
+            );
+            if (planned) {
+                new_pos = path->cells[path->step];
+                waiting = cell_eq(new_pos, old_pos);
+            } else {
+                TRACE_BEGIN("astar");
+                new_pos = astar_search(state, a, old_pos, next->last_known_player_location, CELL_FLAG_CREATURE_WALKABLE, ASTAR_SITE_CHASE);
+                TRACE_END("astar");
+                if (cell_eq(new_pos, old_pos)) {
+                    next->last_known_player_location = INVALID_CELL;
+                }
+            }
+        }
+        if (cell_eq(new_pos, old_pos) && !waiting) {
+            new_pos = random_wander(state, old_pos, next->direction, &next->random);
+        }
+
+        bool can_see_player = has_flag(state->grid[new_pos.x][new_pos.y], CELL_FLAG_VISIBLE);
+        if (can_see_player) {
+            next->last_known_player_location = state->player.position;
+        }
+        update_creature_direction(next);
+    } break;
+    case CREATURE_PLAYER: break;
+    }
+    next->position = new_pos;
+}
+
+// cheap stand-in for plan_creature used far from the player: no pathfinding and
+// LOD_COARSE_INTERVAL steps at once, since the creature is scheduled that much later
+void plan_creature_coarse(State *state, Creature *c, Creature *next) {
+    *next = *c;
+    next->previous_position = c->position;
+    Cell pos = c->position;
+    for (int step = 0; step < LOD_COARSE_INTERVAL; step++) {
+        switch (c->type) {
+        case CREATURE_DIGGER: {
+            pos = random_wander(state, pos, next->direction, &next->random);
+        } break;
+        case CREATURE_EVIL_TRIANGLE: {
+            CoordAndDirection cad = bounce_path(state, pos, next->direction);
+            pos = cad.coord;
+            next->direction = cad.direction;
+        } break;
+        case CREATURE_BIG_EVIL_TRIANGLE: {
+            Cell new_pos = pos;
+            if (cell_neq(next->last_known_player_location, INVALID_CELL)) {
+                new_pos = step_towards(state, pos, next->last_known_player_location, CELL_FLAG_CREATURE_WALKABLE);
+                if (cell_eq(new_pos, pos)) {
+                    next->last_known_player_location = INVALID_CELL;
+                }
+            }
+            if (cell_eq(new_pos, pos)) {
+                new_pos = random_wander(state, pos, next->direction, &next->random);
+            }
+            pos = new_pos;
+        } break;
+        case CREATURE_PLAYER: break;
+        }
+    }
+    next->position = pos;
+}
+
+void link_creature_to_chunk(State *state, int idx) {
+    CreatureChunks *chunks = &state->chunks;
+    int chunk = get_chunk(state->creatures[idx].position);
+    chunks->previous[idx] = NO_CREATURE;
+    chunks->next[idx] = chunks->head[chunk];
+    if (chunks->head[chunk] != NO_CREATURE) {
+        chunks->previous[chunks->head[chunk]] = idx;
+    }
+    chunks->head[chunk] = idx;
+}
+
+void unlink_creature_from_chunk(State *state, int idx, int chunk) {
+    CreatureChunks *chunks = &state->chunks;
+    int previous = chunks->previous[idx];
+    int next = chunks->next[idx];
+    if (previous != NO_CREATURE) {
+        chunks->next[previous] = next;
+    } else {
+        chunks->head[chunk] = next;
+    }
+    if (next != NO_CREATURE) {
+        chunks->previous[next] = previous;
+    }
+}
+
+void init_creature_chunks(State *state) {
+    for (int i = 0; i < CHUNK_AMOUNT; i++) {
+        state->chunks.head[i] = NO_CREATURE;
+    }
+    for (int i = 0; i < CREATURE_CAPACITY; i++) {
+        link_creature_to_chunk(state, i);
+    }
+}
+
+static inline bool is_chunk_in(int chunk, Cell min, Cell max) {
+    int cx = chunk % CHUNK_COLUMNS;
+    int cy = chunk / CHUNK_COLUMNS;
+    return cx >= min.x && cx < max.x && cy >= min.y && cy < max.y;
+}
+
+// puts dormant creatures that the player has come close to back on the schedule
+void wake_nearby_creatures(State *state) {
+    Schedule *s = &state->schedule;
+    Cell min, max;
+    get_viewport_chunks(state, LOD_COARSE_MARGIN, &min, &max);
+    for (int cy = min.y; cy < max.y; cy++) {
+        for (int cx = min.x; cx < max.x; cx++) {
+            int chunk = cx + (cy * CHUNK_COLUMNS);
+            for (int i = state->chunks.head[chunk]; i != NO_CREATURE; i = state->chunks.next[i]) {
+                if (!s->scheduled[i]) {
+                    save_creature_for_undo(state, i);
+                    schedule_add(s, i, s->now + (i % creature_action_cost(state->creatures[i].type)));
+                }
+            }
+        }
+    }
+}
+
+// collects the creatures due on the current tick, dormant ones are dropped
+// from the schedule until wake_nearby_creatures finds them again
+void gather_active_creatures(State *state, Cell full_min, Cell full_max, Cell coarse_min, Cell coarse_max) {
+    Schedule *s = &state->schedule;
+    for (int i = s->slots[s->now % SCHEDULE_SLOTS]; i != NO_CREATURE; i = s->next[i]) {
+        save_creature_for_undo(state, i);
+    }
+    state->active_count = 0;
+    int next;
+    for (int i = schedule_take(&state->schedule); i != NO_CREATURE; i = next) {
+        next = state->schedule.next[i];
+        int chunk = get_chunk(state->creatures[i].position);
+        if (is_chunk_in(chunk, full_min, full_max)) {
+            state->active[state->active_count] = (ActiveCreature) { i, SIM_TIER_FULL };
+        } else if (is_chunk_in(chunk, coarse_min, coarse_max)) {
+            state->active[state->active_count] = (ActiveCreature) { i, SIM_TIER_COARSE };
+        } else {
+            continue;
+        }
+        state->active_count++;
+    }
+}
+
+// bouncers and wanderers at full detail go through the batched table kernels,
+// everything else is planned one creature at a time
+static void plan_creatures_job(void *data, int start, int end, int worker) {
+    State *state = (State *)data;
+    AStar *a = state->workers.a_star[worker];
+    for (int batch_start = start; batch_start < end; batch_start += CREATURES_PER_JOB) {
+        TRACE_BEGIN("plan batch");
+        int batch_end = (batch_start + CREATURES_PER_JOB < end) ? batch_start + CREATURES_PER_JOB : end;
+
+        int bounce_count = 0;
+        int bounce_indices[CREATURES_PER_JOB];
+        Cell bounce_positions[CREATURES_PER_JOB];
+        uint16 bounce_directions[CREATURES_PER_JOB];
+
+        int wander_count = 0;
+        int wander_indices[CREATURES_PER_JOB];
+        Cell wander_positions[CREATURES_PER_JOB];
+        uint16 wander_directions[CREATURES_PER_JOB];
+        uint32 wander_randoms[CREATURES_PER_JOB];
+
+        for (int i = batch_start; i < batch_end; i++) {
+            int idx = state->active[i].index;
+            Creature *c = &state->creatures[idx];
+            Creature *next = &state->next_creatures[idx];
+            if (state->active[i].tier != SIM_TIER_FULL) {
+                plan_creature_coarse(state, c, next);
+                continue;
+            }
+            switch (c->type) {
+            case CREATURE_EVIL_TRIANGLE: {
+                bounce_indices[bounce_count] = idx;
+                bounce_positions[bounce_count] = c->position;
+                bounce_directions[bounce_count] = c->direction;
+                bounce_count++;
+            } break;
+            case CREATURE_DIGGER: {
+                wander_indices[wander_count] = idx;
+                wander_positions[wander_count] = c->position;
+                wander_directions[wander_count] = c->direction;
+                wander_randoms[wander_count] = c->random;
+                wander_count++;
+            } break;
+            default: {
+                TRACE_BEGIN_ARG("creature", "index", idx);
+                plan_creature(state, a, &state->paths[idx], c, next);
+                TRACE_END("creature");
+            } break;
+            }
+        }
+
+        bounce_batch(state, bounce_positions, bounce_directions, bounce_count);
+        for (int i = 0; i < bounce_count; i++) {
+            Creature *next = &state->next_creatures[bounce_indices[i]];
+            *next = state->creatures[bounce_indices[i]];
+            next->previous_position = next->position;
+            next->position = bounce_positions[i];
+            next->direction = bounce_directions[i];
+        }
+
+        wander_batch(state, wander_positions, wander_directions, wander_randoms, wander_count);
+        for (int i = 0; i < wander_count; i++) {
+            Creature *next = &state->next_creatures[wander_indices[i]];
+            *next = state->creatures[wander_indices[i]];
+            next->previous_position = next->position;
+            next->position = wander_positions[i];
+            next->random = wander_randoms[i];
+        }
+        TRACE_END("plan batch");
+    }
+}
+
+static inline bool is_moving(State *state, int i) {
+    Creature *next = &state->next_creatures[state->active[i].index];
+    return !state->active[i].blocked && cell_neq(next->position, next->previous_position);
+}
+
+// a blocked creature stays on its cell, so a move into that cell is blocked
+// too. only the one that claimed the cell can be moving into it
+static void block_move(State *state, int i, int *count) {
+    Creature *next = &state->next_creatures[state->active[i].index];
+    state->active[i].blocked = true;
+    add_cell_flags(state, next->previous_position, CELL_FLAG_CREATURE);
+    state->blocked_stack[(*count)++] = i;
+}
+
+// phase two: commits the planned moves. a move goes through when its target
+// is free, no earlier creature in gather order claimed it and it is not a
+// swap with the creature standing there. blocking one move can block the
+// move into the cell it keeps and so on, which is followed to the end before
+// anything is committed, so no two creatures end up on one cell
+void resolve_creatures(State *state) {
+    for (int i = 0; i < state->active_count; i++) {
+        Cell old_pos = state->creatures[state->active[i].index].position;
+        remove_cell_flags(state, old_pos, CELL_FLAG_CREATURE);
+        state->active[i].blocked = false;
+    }
+    for (int i = 0; i < state->active_count; i++) {
+        Creature *next = &state->next_creatures[state->active[i].index];
+        if (cell_eq(next->position, next->previous_position)) {
+            add_cell_flags(state, next->position, CELL_FLAG_CREATURE);
+        } else if (state->claims[next->position.x][next->position.y] == 0) {
+            state->claims[next->position.x][next->position.y] = i + 1;
+        }
+    }
+
+    int blocked_count = 0;
+    for (int i = 0; i < state->active_count; i++) {
+        if (!is_moving(state, i)) {
+            continue;
+        }
+        Creature *next = &state->next_creatures[state->active[i].index];
+        Cell target = next->position;
+        Cell source = next->previous_position;
+        int claim = state->claims[source.x][source.y] - 1;
+        bool swap = (
+            claim >= 0 &&
+            cell_eq(state->next_creatures[state->active[claim].index].previous_position, target)
+        );
+        bool blocked = (
+            swap ||
+            state->claims[target.x][target.y] != i + 1 ||
+            has_flag(state->grid[target.x][target.y], CELL_FLAG_CREATURE)
+        );
+        if (blocked) {
+            block_move(state, i, &blocked_count);
+        }
+    }
+    while (blocked_count > 0) {
+        int i = state->blocked_stack[--blocked_count];
+        Cell kept = state->next_creatures[state->active[i].index].previous_position;
+        int claim = state->claims[kept.x][kept.y] - 1;
+        if (claim >= 0 && is_moving(state, claim)) {
+            block_move(state, claim, &blocked_count);
+        }
+    }
+
+    for (int i = 0; i < state->active_count; i++) {
+        int idx = state->active[i].index;
+        Creature *c = &state->creatures[idx];
+        save_creature_for_undo(state, idx);
+        *c = state->next_creatures[idx];
+        state->claims[c->position.x][c->position.y] = 0;
+        bool blocked = state->active[i].blocked;
+        if (blocked) {
+            c->position = c->previous_position;
+        }
+        advance_cooperative_path(state, idx, !blocked);
+        add_cell_flags(state, c->position, CELL_FLAG_CREATURE);
+
+        int old_chunk = get_chunk(c->previous_position);
+        if (get_chunk(c->position) != old_chunk) {
+            unlink_creature_from_chunk(state, idx, old_chunk);
+            link_creature_to_chunk(state, idx);
+        }
+
+        bool creature_visible = has_flag(c->flags, CREATURE_FLAG_VISIBLE);
+        bool cell_visible = has_flag(state->grid[c->position.x][c->position.y], CELL_FLAG_VISIBLE);
+        if (!creature_visible && cell_visible) {
+            c->flags |= (CREATURE_FLAG_DISCOVERED | CREATURE_FLAG_VISIBLE);
+            state->flags &= ~GAME_FLAG_IS_MOVING;
+        }
+        rehash_creature(state, idx);
+    }
+}
+
+void hide_unseen_creatures(State *state) {
+    Cell min, max;
+    get_viewport_chunks(state, LOD_FULL_MARGIN, &min, &max);
+    for (int cy = min.y; cy < max.y; cy++) {
+        for (int cx = min.x; cx < max.x; cx++) {
+            int chunk = cx + (cy * CHUNK_COLUMNS);
+            for (int i = state->chunks.head[chunk]; i != NO_CREATURE; i = state->chunks.next[i]) {
+                Creature *c = &state->creatures[i];
+                bool creature_visible = has_flag(c->flags, CREATURE_FLAG_VISIBLE);
+                bool cell_visible = has_flag(state->grid[c->position.x][c->position.y], CELL_FLAG_VISIBLE);
+                if (creature_visible && !cell_visible) {
+                    save_creature_for_undo(state, i);
+                    c->flags &= ~CREATURE_FLAG_VISIBLE;
+                    rehash_creature(state, i);
+                }
+            }
+        }
+    }
+}
+
+// runs every creature action due before the player's next action
+void update_creatures(State *state, int player_action_cost) {
+    PROFILE_BEGIN(CREATURES);
+    TRACE_BEGIN("creatures");
+    Schedule *s = &state->schedule;
+    Cell full_min, full_max, coarse_min, coarse_max;
+    get_viewport_chunks(state, LOD_FULL_MARGIN, &full_min, &full_max);
+    get_viewport_chunks(state, LOD_COARSE_MARGIN, &coarse_min, &coarse_max);
+
+    wake_nearby_creatures(state);
+
+    uint32 end = s->now + player_action_cost;
+    for (; s->now < end; s->now++) {
+        gather_active_creatures(state, full_min, full_max, coarse_min, coarse_max);
+        if (state->active_count == 0) {
+            continue;
+        }
+        plan_cooperative_paths(state);
+        parallel_for(&state->workers, state->active_count, CREATURES_PER_JOB, plan_creatures_job, state);
+        TRACE_BEGIN("resolve");
+        resolve_creatures(state);
+        TRACE_END("resolve");
+        for (int i = 0; i < state->active_count; i++) {
+            int idx = state->active[i].index;
+            int cost = creature_action_cost(state->creatures[idx].type);
+            if (state->active[i].tier == SIM_TIER_COARSE) {
+                cost *= LOD_COARSE_INTERVAL;
+            }
+            schedule_add(s, idx, s->now + cost);
+        }
+    }
+    state->turn++;
+    TRACE_END("creatures");
+    PROFILE_END(CREATURES);
+}
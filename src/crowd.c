@@ -0,0 +1,320 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "main.h"
+
+#if CREATURE_CAPACITY <= CREATURES_PER_JOB
+#error "crowd needs a CREATURE_CAPACITY above CREATURES_PER_JOB, build it with crowd.sh"
+#endif
+
+#include "map.c"
+#include "vision.c"
+#include "movement.c"
+#include "jobs.c"
+#include "schedule.c"
+#include "cooperative.c"
+#include "creatures.c"
+#include "undo.c"
+#include "hash.c"
+#include "game.c"
+#include "level.c"
+#include "levels.c"
+#include "platform.c"
+#include "profile.c"
+#include "trace.c"
+#include "work.c"
+#include "world.c"
+#include "autosave.c"
+#include "replay.c"
+#include "sim.c"
+
+// plays the seeds with a population large enough for the creature jobs to be
+// split over the workers, once on one thread and once on WORKER_CAPACITY. the
+// state hash after every turn has to be the same for both, and no two
+// creatures may ever share a cell. before that the bounce and wander kernels
+// are compared against the per-cell rules they were built from, on every cell
+// of each seed's level
+//
+//   crowd                 checks the seeds, exit 1 on any difference
+//   crowd --turns 2000
+
+#define CROWD_SEEDS 3
+
+static const uint32 crowd_seeds[CROWD_SEEDS] = { 8, 3, 1234 };
+
+// a discovered walkable cell in the viewport, the player's position when the
+// draws find none
+static Cell pick_walk_target(State *state, uint32 *random) {
+    for (int i = 0; i < 64; i++) {
+        Cell cell = {
+            state->game_offset.x + random_range(random, 0, GAME_WIDTH - 1),
+            state->game_offset.y + random_range(random, 0, GAME_HEIGHT - 1),
+        };
+        if (!is_cell_out_of_bounds(state, cell) && has_flag(state->grid[cell.x][cell.y], CELL_FLAG_PLAYER_WALKABLE)) {
+            return cell;
+        }
+    }
+    return state->player.position;
+}
+
+// the bounce rule as it was before the tables, reading the grid directly
+static CoordAndDirection reference_bounce(State *state, Cell start, uint8 direction) {
+    Cell n = {start.x, start.y - 1};
+    Cell w = {start.x - 1, start.y};
+    Cell s = {start.x, start.y + 1};
+    Cell e = {start.x + 1, start.y};
+
+    bool n_wall = !is_cell_valid(state, n, CELL_FLAG_WALKABLE);
+    bool w_wall = !is_cell_valid(state, w, CELL_FLAG_WALKABLE);
+    bool s_wall = !is_cell_valid(state, s, CELL_FLAG_WALKABLE);
+    bool e_wall = !is_cell_valid(state, e, CELL_FLAG_WALKABLE);
+
+    Cell ne = {start.x + 1, start.y - 1};
+    Cell nw = {start.x - 1, start.y - 1};
+    Cell sw = {start.x - 1, start.y + 1};
+    Cell se = {start.x + 1, start.y + 1};
+
+    bool ne_open = is_cell_valid(state, ne, CELL_FLAG_WALKABLE);
+    bool nw_open = is_cell_valid(state, nw, CELL_FLAG_WALKABLE);
+    bool sw_open = is_cell_valid(state, sw, CELL_FLAG_WALKABLE);
+    bool se_open = is_cell_valid(state, se, CELL_FLAG_WALKABLE);
+
+    int bounce = -1;
+
+    switch (direction) {
+        case DIAGONAL_NE:
+            if (e_wall) {
+                if (n_wall) { if (sw_open) bounce = DIAGONAL_SW; }
+                else if (nw_open) bounce = DIAGONAL_NW;
+                else bounce = DIAGONAL_SW;
+            } else if (n_wall && se_open) bounce = DIAGONAL_SE;
+            else if (!n_wall && ne_open) bounce = DIAGONAL_NE;
+            else bounce = DIAGONAL_SW;
+            break;
+
+        case DIAGONAL_NW:
+            if (w_wall) {
+                if (n_wall) { if (se_open) bounce = DIAGONAL_SE; }
+                else if (ne_open) bounce = DIAGONAL_NE;
+                else bounce = DIAGONAL_SE;
+            } else if (n_wall && sw_open) bounce = DIAGONAL_SW;
+            else if (!n_wall && nw_open) bounce = DIAGONAL_NW;
+            else bounce = DIAGONAL_SE;
+            break;
+
+        case DIAGONAL_SW:
+            if (w_wall) {
+                if (s_wall) { if (ne_open) bounce = DIAGONAL_NE; }
+                else if (se_open) bounce = DIAGONAL_SE;
+                else bounce = DIAGONAL_NE;
+            } else if (s_wall && nw_open) bounce = DIAGONAL_NW;
+            else if (!s_wall && sw_open) bounce = DIAGONAL_SW;
+            else bounce = DIAGONAL_NE;
+            break;
+
+        case DIAGONAL_SE:
+            if (e_wall) {
+                if (s_wall) { if (nw_open) bounce = DIAGONAL_NW; }
+                else if (sw_open) bounce = DIAGONAL_SW;
+                else bounce = DIAGONAL_NW;
+            } else if (s_wall && ne_open) bounce = DIAGONAL_NE;
+            else if (!s_wall && se_open) bounce = DIAGONAL_SE;
+            else bounce = DIAGONAL_NW;
+            break;
+
+        default:
+            return (CoordAndDirection) { start, 0 };
+    }
+
+    switch (bounce) {
+        case DIAGONAL_NE: return (CoordAndDirection){ne, DIAGONAL_NE};
+        case DIAGONAL_NW: return (CoordAndDirection){nw, DIAGONAL_NW};
+        case DIAGONAL_SE: return (CoordAndDirection){se, DIAGONAL_SE};
+        case DIAGONAL_SW: return (CoordAndDirection){sw, DIAGONAL_SW};
+    }
+
+    return (CoordAndDirection) { start, direction };
+}
+
+// the wander rule as it was before the tables
+static Cell reference_wander(State *state, Cell start, uint8 direction, uint32 *seed) {
+    int random = random_range(seed, 0, 3);
+    Cell backtrack_cell = get_cell_in_direction(start, (direction + 2) % 4, 1);
+    for (int i = 0; i < 4; i++) {
+        Cell position;
+        switch (random) {
+        case 0: position = (Cell) {start.x, start.y - 1}; break;
+        case 1: position = (Cell) {start.x - 1, start.y}; break;
+        case 2: position = (Cell) {start.x, start.y + 1}; break;
+        default: position = (Cell) {start.x + 1, start.y}; break;
+        }
+        bool valid = is_cell_valid(state, position, CELL_FLAG_WALKABLE);
+        bool backtrack = cell_eq(backtrack_cell, position);
+        if (valid && !backtrack) {
+            return position;
+        }
+        random = (random + 1) % 4;
+    }
+    if (is_cell_valid(state, backtrack_cell, CELL_FLAG_WALKABLE)) {
+        return backtrack_cell;
+    }
+    return start;
+}
+
+// every cell and direction of the level through both kernels and both
+// reference rules, a few random streams each for wandering. returns how many
+// results differ
+static int check_kernels(uint32 seed) {
+    State *state = (State *)calloc(1, sizeof(State));
+    init_game(state, seed, 1);
+    int differences = 0;
+    uint32 random = seed | 1;
+    for (int x = 0; x < GRID_WIDTH; x++) {
+        for (int y = 0; y < GRID_HEIGHT; y++) {
+            Cell start = { x, y };
+            for (uint8 direction = 0; direction <= DIAGONAL_SE + 1; direction++) {
+                CoordAndDirection table = bounce_path(state, start, direction);
+                CoordAndDirection reference = reference_bounce(state, start, direction);
+                differences += cell_neq(table.coord, reference.coord) || table.direction != reference.direction;
+            }
+            for (uint8 direction = 0; direction <= ORTHAGONAL_E; direction++) {
+                for (int stream = 0; stream < 4; stream++) {
+                    uint32 table_random = random_next(&random);
+                    uint32 reference_random = table_random;
+                    Cell table = random_wander(state, start, direction, &table_random);
+                    Cell reference = reference_wander(state, start, direction, &reference_random);
+                    differences += cell_neq(table, reference) || table_random != reference_random;
+                }
+            }
+        }
+    }
+    deinit_game(state);
+    free(state);
+    return differences;
+}
+
+// the first creature found on a cell another one already stands on, -1 when
+// they all have a cell of their own
+static int find_shared_cell(State *state) {
+    static int owners[GRID_WIDTH][GRID_HEIGHT];
+    static int stamp;
+    static int stamps[GRID_WIDTH][GRID_HEIGHT];
+    stamp++;
+    for (int i = 0; i < CREATURE_CAPACITY; i++) {
+        Cell p = state->creatures[i].position;
+        if (stamps[p.x][p.y] == stamp && owners[p.x][p.y] != i) {
+            return i;
+        }
+        stamps[p.x][p.y] = stamp;
+        owners[p.x][p.y] = i;
+    }
+    return -1;
+}
+
+typedef struct CrowdRun {
+    uint64 *hashes;
+    int split_runs;
+    int shared_turn;
+    int shared_creature;
+} CrowdRun;
+
+// the player walks to random cells in view like workload's explore scenario
+static CrowdRun run_crowd(uint32 seed, int turns, int worker_count) {
+    CrowdRun run = { .shared_turn = -1 };
+    run.hashes = (uint64 *)malloc(turns * sizeof(uint64));
+    State *state = (State *)calloc(1, sizeof(State));
+    init_game(state, seed, worker_count);
+    uint32 random = seed | 1;
+    for (int turn = 0; turn < turns; turn++) {
+        hide_unseen_creatures(state);
+        SimCommand command = { .action = TURN_ACTION_CONTINUE };
+        if (!has_flag(state->flags, GAME_FLAG_IS_MOVING)) {
+            command.action = TURN_ACTION_CLICK;
+            command.target = pick_walk_target(state, &random);
+        }
+        run_turn(state, &command);
+        run.hashes[turn] = get_state_hash(state);
+        int shared = find_shared_cell(state);
+        if (shared >= 0 && run.shared_turn < 0) {
+            run.shared_turn = turn;
+            run.shared_creature = shared;
+        }
+    }
+    // the generation only moves when parallel_for split the creatures over
+    // the threads, once per tick
+    run.split_runs = state->workers.generation;
+    deinit_game(state);
+    free(state);
+    return run;
+}
+
+static void usage(void) {
+    printf(
+        "usage: crowd [options]\n"
+        "  --turns N  turns per seed and worker count (default 500)\n"
+    );
+}
+
+int main(int argc, char **argv) {
+    int turns = 500;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--turns") == 0 && has_value) {
+            turns = atoi(argv[++i]);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (turns < 1) {
+        turns = 1;
+    }
+
+    init_movement_tables();
+    int failures = 0;
+    for (int i = 0; i < CROWD_SEEDS; i++) {
+        uint32 seed = crowd_seeds[i];
+        int differences = check_kernels(seed);
+        if (differences > 0) {
+            printf("seed %u: %d bounce or wander results differ from the reference rules\n", seed, differences);
+            failures++;
+        }
+        CrowdRun single = run_crowd(seed, turns, 1);
+        CrowdRun parallel = run_crowd(seed, turns, WORKER_CAPACITY);
+        int diverged = -1;
+        for (int turn = 0; turn < turns && diverged < 0; turn++) {
+            if (single.hashes[turn] != parallel.hashes[turn]) {
+                diverged = turn;
+            }
+        }
+        printf("seed %u: %d creatures, planned in parallel on %d ticks, ",
+            seed, CREATURE_CAPACITY, parallel.split_runs
+        );
+        if (diverged >= 0) {
+            printf("1 and %d workers diverge at turn %d\n", WORKER_CAPACITY, diverged);
+            failures++;
+        } else {
+            printf("1 and %d workers match over %d turns\n", WORKER_CAPACITY, turns);
+        }
+        if (parallel.split_runs == 0) {
+            printf("  no tick had more than %d creatures to plan, nothing ran in parallel\n", CREATURES_PER_JOB);
+            failures++;
+        }
+        CrowdRun *runs[2] = { &single, &parallel };
+        for (int r = 0; r < 2; r++) {
+            if (runs[r]->shared_turn >= 0) {
+                printf("  creature %d shares a cell at turn %d with %d workers\n",
+                    runs[r]->shared_creature, runs[r]->shared_turn, (r == 0) ? 1 : WORKER_CAPACITY
+                );
+                failures++;
+            }
+        }
+        free(single.hashes);
+        free(parallel.hashes);
+    }
+    return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+
+void update_game_offset(State *state) {
+    Cell local_dimensions = { GAME_WIDTH, GAME_HEIGHT };
+    state->game_offset = cell_subtract(state->player.position, cell_divide(local_dimensions, 2));
+}
+
+// every level has a random stream of its own derived from the seed, the top
+// one starts from the seed itself
+static uint32 get_level_random(uint32 seed, int depth) {
+    uint32 random = (depth == 0) ? seed : (uint32)hash_pair(seed, depth, 0);
+    return (random != 0) ? random : 1;
+}
+
+static bool is_crowd_cell_free(LevelGen *gen, Cell cell, int count) {
+    if (!has_flag(gen->grid[cell.x][cell.y], CELL_FLAG_WALKABLE) || cell_eq(cell, gen->player.position)) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        if (cell_eq(cell, gen->creatures[i].position)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// a level only has two creatures of its own. builds with a larger
+// CREATURE_CAPACITY fill the rest with every kind, each on a floor cell of
+// its own
+static void place_crowd(LevelGen *gen) {
+    static const CreatureType types[3] = { CREATURE_DIGGER, CREATURE_EVIL_TRIANGLE, CREATURE_BIG_EVIL_TRIANGLE };
+    for (int i = 2; i < CREATURE_CAPACITY; i++) {
+        Cell cell;
+        do {
+            cell = (Cell) { random_range(&gen->random, 0, GRID_WIDTH - 1), random_range(&gen->random, 0, GRID_HEIGHT - 1) };
+        } while (!is_crowd_cell_free(gen, cell, i));
+        gen->creatures[i] = (Creature) {
+            .type = types[i % 3],
+            .position = cell,
+            .previous_position = cell,
+            .direction = DIAGONAL_NE + ((i / 3) % 4),
+            .last_known_player_location = INVALID_CELL,
+        };
+    }
+}
+
+// everything random in a level is derived from the seed and the depth, so the
+// same seed gives the same levels and the same creature behaviour on every
+// frontend, whichever thread generated them
+void generate_level(LevelGen *gen, uint32 seed, int depth) {
+    gen->seed = seed;
+    gen->depth = depth;
+    gen->random = get_level_random(seed, depth);
+
+    gen->player = (Creature) {
+        .type = CREATURE_PLAYER,
+    };
+
+    memset(gen->creatures, 0, sizeof(gen->creatures));
+    gen->creatures[0] = (Creature) {
+        .type = CREATURE_EVIL_TRIANGLE,
+        .direction = DIAGONAL_NE,
+    };
+    gen->creatures[1] = (Creature) {
+        .type = CREATURE_BIG_EVIL_TRIANGLE,
+        .last_known_player_location = INVALID_CELL,
+    };
+
+    generate_map(gen);
+    place_crowd(gen);
+
+    for (int i = 0; i < CREATURE_CAPACITY; i++) {
+        gen->creatures[i].random = random_next(&gen->random);
+    }
+}
+
+// swaps the generated grid in and rebuilds everything derived from it. the
+// grid that was played goes to gen, for the generator to fill next
+static void enter_level(State *state, LevelGen *gen) {
+    Grid grid = state->grid;
+    state->grid = gen->grid;
+    gen->grid = grid;
+
+    state->depth = gen->depth;
+    state->random = gen->random;
+    state->player = gen->player;
+    memcpy(state->creatures, gen->creatures, sizeof(state->creatures));
+    state->flags &= ~GAME_FLAG_IS_MOVING;
+    // creatures that have not acted yet still block the ones that do
+    for (int i = 0; i < CREATURE_CAPACITY; i++) {
+        Cell p = state->creatures[i].position;
+        state->grid[p.x][p.y] |= CELL_FLAG_CREATURE;
+    }
+
+    build_neighbour_masks(state);
+    init_creature_chunks(state);
+    reset_state_hash(state);
+    schedule_init(&state->schedule);
+    reset_cooperative_paths(state);
+    touch_all_chunks(state);
+    update_game_offset(state);
+    discover_visible_cells(state);
+}
+
+static void *generator_main(void *arg) {
+    LevelGenerator *g = (LevelGenerator *)arg;
+    TRACE_THREAD("generator");
+    pthread_mutex_lock(&g->mutex);
+    while (true) {
+        while (!g->quit && g->done) {
+            pthread_cond_wait(&g->wake, &g->mutex);
+        }
+        if (g->quit) {
+            break;
+        }
+        uint32 seed = g->wanted_seed;
+        int depth = g->wanted_depth;
+        pthread_mutex_unlock(&g->mutex);
+        TRACE_BEGIN_ARG("generate level", "depth", depth);
+        generate_level(&g->level, seed, depth);
+        TRACE_END("generate level");
+        pthread_mutex_lock(&g->mutex);
+        // a different level may have been asked for in the meantime
+        g->done = g->wanted_seed == seed && g->wanted_depth == depth;
+        pthread_cond_broadcast(&g->wake);
+    }
+    pthread_mutex_unlock(&g->mutex);
+    return 0;
+}
+
+// starts generating the level below the current one, unless it already is.
+// called after anything that changes the seed or the depth
+void prepare_next_level(State *state) {
+    LevelGenerator *g = &state->generator;
+    if (!g->running) {
+        return;
+    }
+    pthread_mutex_lock(&g->mutex);
+    bool wanted = g->wanted_seed == state->seed && g->wanted_depth == state->depth + 1;
+    if (!wanted) {
+        g->wanted_seed = state->seed;
+        g->wanted_depth = state->depth + 1;
+        g->done = false;
+        pthread_cond_signal(&g->wake);
+    }
+    pthread_mutex_unlock(&g->mutex);
+}
+
+// enters the level below the current one, for when it was never visited.
+// it was generated while this one was played, the wait is only for a player
+// faster than the generator. false when there is no generator, like in a
+// world game
+bool take_generated_level(State *state) {
+    LevelGenerator *g = &state->generator;
+    if (!g->running) {
+        return false;
+    }
+    prepare_next_level(state);
+    pthread_mutex_lock(&g->mutex);
+    while (!g->done) {
+        pthread_cond_wait(&g->wake, &g->mutex);
+    }
+    pthread_mutex_unlock(&g->mutex);
+
+    enter_level(state, &g->level);
+    return true;
+}
+
+static void generator_start(State *state) {
+    LevelGenerator *g = &state->generator;
+    g->quit = false;
+    g->done = true;
+    g->wanted_seed = g->level.seed;
+    g->wanted_depth = g->level.depth;
+    pthread_mutex_init(&g->mutex, 0);
+    pthread_cond_init(&g->wake, 0);
+    pthread_create(&g->thread, 0, generator_main, g);
+    g->running = true;
+}
+
+static void generator_stop(LevelGenerator *g) {
+    if (!g->running) {
+        return;
+    }
+    pthread_mutex_lock(&g->mutex);
+    g->quit = true;
+    pthread_cond_signal(&g->wake);
+    pthread_mutex_unlock(&g->mutex);
+    pthread_join(g->thread, 0);
+    pthread_cond_destroy(&g->wake);
+    pthread_mutex_destroy(&g->mutex);
+    g->running = false;
+}
+
+// the first level is generated right here, the one below it starts on the
+// generator thread and is usually done long before the player finds the stairs
+void init_game(State *state, uint32 seed, int worker_count) {
+    state->seed = seed;
+    state->grid = (Grid)malloc(GRID_BYTES);
+    state->generator.level.grid = (Grid)malloc(GRID_BYTES);
+
+    init_movement_tables();
+    generate_level(&state->generator.level, seed, 0);
+    enter_level(state, &state->generator.level);
+
+    workers_init(&state->workers, worker_count);
+
+    state->levels.budget = LEVEL_CACHE_BUDGET;
+    generator_start(state);
+    prepare_next_level(state);
+}
+
+void deinit_game(State *state) {
+    generator_stop(&state->generator);
+    clear_level_cache(state);
+    workers_deinit(&state->workers);
+    free(state->generator.level.grid);
+    free(state->grid);
+}
@@ -0,0 +1,50 @@
+#include "main.h"
+
+// the grid and creature parts of the hash are maintained by write_cell and
+// rehash_creature, these only rebuild them from scratch and fold in the few
+// scalars that change every turn anyway
+
+static uint64 compute_grid_hash(State *state) {
+    uint64 hash = 0;
+    for (int x = 0; x < GRID_WIDTH; x++) {
+        for (int y = 0; y < GRID_HEIGHT; y++) {
+            hash ^= cell_hash_key((Cell) { x, y }, state->grid[x][y]);
+        }
+    }
+    return hash;
+}
+
+// for after the grid or the creatures were written directly, like map generation
+void reset_state_hash(State *state) {
+    state->hash.grid = compute_grid_hash(state);
+    state->hash.creatures = 0;
+    for (int i = 0; i <= HASH_SLOT_PLAYER; i++) {
+        state->hash.creature_keys[i] = 0;
+        rehash_creature(state, i);
+    }
+}
+
+static uint64 fold_state_hash(State *state, uint64 grid, uint64 creatures) {
+    uint64 hash = hash_pair(grid ^ creatures, state->turn, state->schedule.now);
+    hash = hash_pair(hash, state->random, state->flags);
+    hash = hash_pair(hash, state->depth, 0);
+    hash = hash_pair(hash, state->mouse_target.x, state->mouse_target.y);
+    return hash_pair(hash, state->game_offset.x, state->game_offset.y);
+}
+
+// O(1) fingerprint of everything that decides how the game continues. two
+// states with the same hash play on the same way, so replays and caches can
+// compare or key on it
+uint64 get_state_hash(State *state) {
+    return fold_state_hash(state, state->hash.grid, state->hash.creatures);
+}
+
+// the same value without trusting the incremental parts, for checking them
+uint64 compute_state_hash(State *state) {
+    uint64 creatures = 0;
+    for (int i = 0; i < CREATURE_CAPACITY; i++) {
+        creatures ^= creature_hash_key(i, &state->creatures[i]);
+    }
+    creatures ^= creature_hash_key(HASH_SLOT_PLAYER, &state->player);
+    return fold_state_hash(state, compute_grid_hash(state), creatures);
+}
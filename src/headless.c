@@ -0,0 +1,352 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "main.h"
+#include "map.c"
+#include "vision.c"
+#include "movement.c"
+#include "jobs.c"
+#include "schedule.c"
+#include "cooperative.c"
+#include "creatures.c"
+#include "undo.c"
+#include "hash.c"
+#include "game.c"
+#include "level.c"
+#include "levels.c"
+#include "platform.c"
+#include "profile.c"
+#include "trace.c"
+#include "work.c"
+#include "world.c"
+#include "autosave.c"
+#include "replay.c"
+#include "sim.c"
+#include "raster.c"
+#include "backend_software.c"
+#include "sprites.c"
+#include "renderer.c"
+
+// runs the game without a window: simulates a number of waiting turns from a
+// seed, renders the result with the software backend and writes or checks it.
+//
+//   headless --seed 8 --turns 100 --out frame.png
+//   headless --seed 8 --turns 100 --golden golden.ppm
+//   headless --seed 8 --frames 500 --map
+//   headless --seed 8 --turns 1000 --record run.rec
+//   headless --replay run.rec --out last.png
+//   headless --seed 8 --turns 500 --save level.lvl
+//   headless --load level.lvl --turns 100 --out frame.png
+//   headless --seed 8 --world world.wld --turns 100
+//   headless --seed 8 --turns 200 --undo 50
+//   headless --seed 8 --turns 1000 --autosave auto.lvl
+//   headless --seed 8 --turns 200 --frames 50 --trace trace.json
+
+static void usage(void) {
+    printf(
+        "usage: headless [options]\n"
+        "  --seed N      map and creature seed (default 8)\n"
+        "  --turns N     turns the player waits before rendering (default 0)\n"
+        "  --frames N    frames to render and time, each one redrawn (default 1)\n"
+        "  --map         render the map view instead of the game view\n"
+        "  --out FILE    write the last frame, .png or .ppm\n"
+        "  --golden FILE compare the last frame against a ppm, exit 1 on mismatch\n"
+        "  --record FILE write the seed, the turns and their state hashes, not with\n"
+        "                --load or --world\n"
+        "  --replay FILE run a recording as fast as possible instead of waiting turns,\n"
+        "                exit 1 when a state hash differs from the recorded one\n"
+        "  --load FILE   start from a saved level instead of the seed\n"
+        "  --save FILE   save the level after the turns\n"
+        "  --world FILE  play on a mapped world file, created from the seed when missing\n"
+        "  --undo N      take the last N turns back and check the state against the\n"
+        "                one before them, exit 1 when it differs\n"
+        "  --autosave FILE save the level to FILE in the background during the turns\n"
+        "  --level-budget N bytes of packed levels kept in memory (default 1 MiB)\n"
+        "  --trace FILE  write the turns and frames as chrome trace json, needs -DTRACE\n"
+    );
+}
+
+static bool ends_with(const char *s, const char *suffix) {
+    size_t length = strlen(s);
+    size_t suffix_length = strlen(suffix);
+    return length >= suffix_length && strcmp(s + length - suffix_length, suffix) == 0;
+}
+
+int main(int argc, char **argv) {
+    uint32 seed = 8;
+    int turns = 0;
+    int frames = 1;
+    int undo = 0;
+    bool map_view = false;
+    const char *out = 0;
+    const char *golden = 0;
+    const char *record_path = 0;
+    const char *replay_path = 0;
+    const char *load_path = 0;
+    const char *save_path = 0;
+    const char *world_path = 0;
+    const char *autosave_path = 0;
+    const char *trace_path = 0;
+    long level_budget = -1;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = (uint32)strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--turns") == 0 && has_value) {
+            turns = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--undo") == 0 && has_value) {
+            undo = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--map") == 0) {
+            map_view = true;
+        } else if (strcmp(argv[i], "--out") == 0 && has_value) {
+            out = argv[++i];
+        } else if (strcmp(argv[i], "--golden") == 0 && has_value) {
+            golden = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && has_value) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && has_value) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--load") == 0 && has_value) {
+            load_path = argv[++i];
+        } else if (strcmp(argv[i], "--save") == 0 && has_value) {
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "--world") == 0 && has_value) {
+            world_path = argv[++i];
+        } else if (strcmp(argv[i], "--autosave") == 0 && has_value) {
+            autosave_path = argv[++i];
+        } else if (strcmp(argv[i], "--level-budget") == 0 && has_value) {
+            level_budget = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--trace") == 0 && has_value) {
+            trace_path = argv[++i];
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (frames < 1) {
+        frames = 1;
+    }
+    // a recording only holds the seed, it replays from the generated level
+    if ((record_path || replay_path) && (load_path || world_path)) {
+        printf("--record and --replay start from the seed, they cannot be used with --load or --world\n");
+        return 2;
+    }
+
+    software_init(CELLSIZE * GAME_WIDTH, CELLSIZE * GAME_HEIGHT);
+
+    Recording replay = { 0 };
+    if (replay_path) {
+        if (!load_recording(&replay, replay_path)) {
+            printf("could not read %s\n", replay_path);
+            return 2;
+        }
+        seed = replay.seed;
+    }
+
+    int result = 0;
+    State *state = (State *)calloc(1, sizeof(State));
+    if (world_path) {
+        clock_t open_start = clock();
+        if (!open_or_create_world(state, world_path, seed, WORKER_COUNT)) {
+            printf("could not open %s\n", world_path);
+            return 2;
+        }
+        seed = state->seed;
+        printf("opened %s in %.2f ms\n", world_path, ((double)(clock() - open_start) * 1000.0) / CLOCKS_PER_SEC);
+    } else {
+        init_game(state, seed, WORKER_COUNT);
+    }
+    if (level_budget >= 0) {
+        state->levels.budget = level_budget;
+    }
+    if (load_path) {
+        clock_t load_start = clock();
+        if (!load_level(state, load_path)) {
+            printf("could not read %s\n", load_path);
+            return 2;
+        }
+        seed = state->seed;
+        printf("loaded %s in %.2f ms\n", load_path, ((double)(clock() - load_start) * 1000.0) / CLOCKS_PER_SEC);
+    }
+    #if TRACE
+    if (trace_path) {
+        trace_start();
+    }
+    #else
+    if (trace_path) {
+        printf("tracing needs a build with -DTRACE\n");
+        return 2;
+    }
+    #endif
+
+    if (replay_path) {
+        clock_t replay_start = clock();
+        int mismatch = replay_recording(state, &replay);
+        double replay_ms = ((double)(clock() - replay_start) * 1000.0) / CLOCKS_PER_SEC;
+        if (mismatch >= 0) {
+            printf("replay diverged at entry %d of %d\n", mismatch, replay.count);
+            result = 1;
+        }
+        printf("replayed %d entries in %.1f ms, %.3f ms per entry\n",
+            replay.count, replay_ms, (replay.count > 0) ? replay_ms / replay.count : 0.0
+        );
+        free_recording(&replay);
+    } else {
+        // turns run on this thread, there is no input to overlap with
+        if (record_path) {
+            start_recording(&state->recording, seed);
+        }
+        if (autosave_path && !autosave_start(state, autosave_path)) {
+            printf("cannot autosave to %s\n", autosave_path);
+            return 2;
+        }
+        SimCommand wait = { .action = TURN_ACTION_WAIT };
+        uint64 *hashes = (uint64 *)malloc((turns + 1) * sizeof(uint64));
+        for (int i = 0; i < turns; i++) {
+            hide_unseen_creatures(state);
+            hashes[i] = get_state_hash(state);
+            PROFILE_BEGIN(TURN);
+            TRACE_BEGIN("turn");
+            run_turn(state, &wait);
+            TRACE_END("turn");
+            PROFILE_END(TURN);
+            #if PROFILE
+            profile_frame();
+            #endif
+            record_command(state, &wait, true, true);
+            autosave_turn(state);
+        }
+        if (autosave_path) {
+            if (autosave_stop(state)) {
+                printf("autosaved %d times, longest capture %.3f ms\n",
+                    state->autosave.saves, state->autosave.max_capture_ms
+                );
+            } else {
+                printf("could not write %s\n", autosave_path);
+                result = 1;
+            }
+        }
+        if (undo > turns) {
+            undo = turns;
+        }
+        if (undo > 0) {
+            clock_t undo_start = clock();
+            int undone = 0;
+            while (undone < undo && undo_turn(state)) {
+                undone++;
+            }
+            double undo_ms = ((double)(clock() - undo_start) * 1000.0) / CLOCKS_PER_SEC;
+            bool matches = undone == undo && get_state_hash(state) == hashes[turns - undo];
+            printf("undid %d of %d turns in %.2f ms, state %s turn %d\n",
+                undone, undo, undo_ms, matches ? "matches" : "differs from", turns - undo
+            );
+            if (!matches) {
+                result = 1;
+            }
+        }
+        free(hashes);
+        if (record_path && !save_recording(&state->recording, record_path)) {
+            printf("could not write %s\n", record_path);
+            result = 1;
+        }
+        free_recording(&state->recording);
+    }
+    if (save_path) {
+        clock_t save_start = clock();
+        if (save_level(state, save_path)) {
+            printf("saved %s in %.2f ms\n", save_path, ((double)(clock() - save_start) * 1000.0) / CLOCKS_PER_SEC);
+        } else {
+            printf("could not write %s\n", save_path);
+            result = 1;
+        }
+    }
+    hide_unseen_creatures(state);
+    state->mouse_current = state->player.position;
+    state->turn_time = CELLSIZE;
+
+    FrameSnapshot *snapshot = (FrameSnapshot *)calloc(1, sizeof(FrameSnapshot));
+    capture_snapshot(state, snapshot, 0, 0);
+
+    clock_t start = clock();
+    for (int i = 0; i < frames; i++) {
+        #if PROFILE
+        profile_frame();
+        #endif
+        state->frame.valid = false;
+        PROFILE_BEGIN(RENDER);
+        TRACE_BEGIN("render");
+        if (map_view) {
+            draw_map_only(state, snapshot);
+        } else {
+            render(state, snapshot);
+        }
+        TRACE_END("render");
+        PROFILE_END(RENDER);
+    }
+    double elapsed_ms = ((double)(clock() - start) * 1000.0) / CLOCKS_PER_SEC;
+    printf("seed %u, %d turns, %d frames, %.3f ms per frame\n", seed, turns, frames, elapsed_ms / frames);
+    #if PROFILE
+    print_profile_stats();
+    print_astar_stats();
+    if (!write_profile_csv("profile.csv")) {
+        printf("could not write profile.csv\n");
+    }
+    if (!write_astar_csv("astar.csv")) {
+        printf("could not write astar.csv\n");
+    }
+    #endif
+    #if COUNTERS
+    print_work_counters();
+    #endif
+
+    if (out) {
+        bool written = ends_with(out, ".png") ? software_write_png(out) : software_write_ppm(out);
+        if (!written) {
+            printf("could not write %s\n", out);
+            result = 1;
+        }
+    }
+    if (golden) {
+        int different = software_compare_ppm(golden);
+        if (different != 0) {
+            if (different < 0) {
+                printf("could not read %s\n", golden);
+            } else {
+                printf("%d pixels differ from %s\n", different, golden);
+            }
+            result = 1;
+        }
+    }
+
+    if (state->tiles.loaded) {
+        gfx_unload_image(state->tiles.image);
+    }
+    unload_sprite_atlas(&state->sprites);
+    unload_map_overview(&state->overview);
+    unload_frame_cache(&state->frame);
+    software_deinit();
+    free(snapshot);
+
+    if (!close_world(state)) {
+        printf("could not write %s\n", world_path);
+        result = 1;
+    }
+    deinit_game(state);
+    #if TRACE
+    if (trace_path && !trace_stop(trace_path)) {
+        printf("could not write %s\n", trace_path);
+        result = 1;
+    }
+    #endif
+    free(state);
+
+    return result;
+}
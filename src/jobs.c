@@ -0,0 +1,110 @@
+#include <pthread.h>
+#include "main.h"
+
+static void workers_run_batches(Workers *w, int worker) {
+    while (true) {
+        pthread_mutex_lock(&w->mutex);
+        int start = w->next_item;
+        w->next_item += w->batch_size;
+        pthread_mutex_unlock(&w->mutex);
+
+        if (start >= w->item_count) {
+            return;
+        }
+        int end = start + w->batch_size;
+        if (end > w->item_count) {
+            end = w->item_count;
+        }
+        w->function(w->data, start, end, worker);
+    }
+}
+
+static void *worker_main(void *arg) {
+    WorkerStart *start = (WorkerStart *)arg;
+    Workers *w = start->workers;
+    int seen_generation = 0;
+    TRACE_THREAD("worker");
+    while (true) {
+        pthread_mutex_lock(&w->mutex);
+        while (!w->quit && w->generation == seen_generation) {
+            pthread_cond_wait(&w->work_ready, &w->mutex);
+        }
+        if (w->quit) {
+            pthread_mutex_unlock(&w->mutex);
+            return 0;
+        }
+        seen_generation = w->generation;
+        pthread_mutex_unlock(&w->mutex);
+
+        workers_run_batches(w, start->index);
+
+        pthread_mutex_lock(&w->mutex);
+        w->busy_count--;
+        if (w->busy_count == 0) {
+            pthread_cond_signal(&w->work_done);
+        }
+        pthread_mutex_unlock(&w->mutex);
+    }
+}
+
+void workers_init(Workers *w, int count) {
+    if (count < 1) {
+        count = 1;
+    } else if (count > WORKER_CAPACITY) {
+        count = WORKER_CAPACITY;
+    }
+    w->count = count;
+    pthread_mutex_init(&w->mutex, 0);
+    pthread_cond_init(&w->work_ready, 0);
+    pthread_cond_init(&w->work_done, 0);
+    for (int i = 0; i < count; i++) {
+        w->a_star[i] = (AStar *)malloc(sizeof(AStar));
+    }
+    // worker 0 is the calling thread, it takes part in every parallel_for
+    for (int i = 1; i < count; i++) {
+        w->starts[i] = (WorkerStart) { w, i };
+        pthread_create(&w->threads[i], 0, worker_main, &w->starts[i]);
+    }
+}
+
+void workers_deinit(Workers *w) {
+    pthread_mutex_lock(&w->mutex);
+    w->quit = true;
+    pthread_cond_broadcast(&w->work_ready);
+    pthread_mutex_unlock(&w->mutex);
+    for (int i = 1; i < w->count; i++) {
+        pthread_join(w->threads[i], 0);
+    }
+    for (int i = 0; i < w->count; i++) {
+        free(w->a_star[i]);
+    }
+    pthread_cond_destroy(&w->work_done);
+    pthread_cond_destroy(&w->work_ready);
+    pthread_mutex_destroy(&w->mutex);
+}
+
+void parallel_for(Workers *w, int item_count, int batch_size, JobFunction function, void *data) {
+    if (w->count == 1 || item_count <= batch_size) {
+        function(data, 0, item_count, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&w->mutex);
+    w->function = function;
+    w->data = data;
+    w->item_count = item_count;
+    w->batch_size = batch_size;
+    w->next_item = 0;
+    w->busy_count = w->count - 1;
+    w->generation++;
+    pthread_cond_broadcast(&w->work_ready);
+    pthread_mutex_unlock(&w->mutex);
+
+    workers_run_batches(w, 0);
+
+    pthread_mutex_lock(&w->mutex);
+    while (w->busy_count > 0) {
+        pthread_cond_wait(&w->work_done, &w->mutex);
+    }
+    pthread_mutex_unlock(&w->mutex);
+}
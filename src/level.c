@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+
+// a level file holds only what cannot be rebuilt: the grid, the creatures,
+// the schedule and the rng, written as one bit stream. the grid is stored row
+// by row as runs of equal cells, each the cell flags and the length minus one
+//
+//   header        magic, version
+//   size          GRID_WIDTH, GRID_HEIGHT, CREATURE_CAPACITY
+//   game          seed, depth, random, turn, schedule tick, flags, mouse target
+//   creatures     the player, then every creature
+//   schedule      count, then index and delay of each scheduled creature
+//   grid          GRID_HEIGHT rows of runs
+
+#define LEVEL_MAGIC 0x4c564543u
+#define LEVEL_VERSION 3
+#define LEVEL_FLAG_BITS 7
+#define LEVEL_DEPTH_BITS 16
+// coordinates are stored +1 and run lengths -1, both fit in this
+#define LEVEL_COORD_BITS ((GRID_LARGEST_SIDE < (1 << 8)) ? 8 : (GRID_LARGEST_SIDE < (1 << 12)) ? 12 : 16)
+#define LEVEL_INDEX_BITS 16
+#define LEVEL_DELAY_BITS 7
+
+static void open_bit_stream(BitStream *s, FILE *file) {
+    s->file = file;
+    s->memory = 0;
+    s->bits = 0;
+    s->count = 0;
+    s->length = 0;
+    s->position = 0;
+    s->failed = false;
+}
+
+static void open_memory_bit_stream(BitStream *s, uint8 *memory, size_t size) {
+    open_bit_stream(s, 0);
+    s->memory = memory;
+    s->memory_size = size;
+    s->memory_used = 0;
+}
+
+static void flush_bit_stream(BitStream *s) {
+    if (s->memory) {
+        if (s->memory_used + s->length > s->memory_size) {
+            s->failed = true;
+        } else {
+            memcpy(s->memory + s->memory_used, s->buffer, s->length);
+            s->memory_used += s->length;
+        }
+    } else if (s->length > 0 && fwrite(s->buffer, 1, s->length, s->file) != (size_t)s->length) {
+        s->failed = true;
+    }
+    s->length = 0;
+}
+
+static int fill_bit_stream(BitStream *s) {
+    if (!s->memory) {
+        return fread(s->buffer, 1, LEVEL_BUFFER_SIZE, s->file);
+    }
+    size_t length = s->memory_size - s->memory_used;
+    if (length > LEVEL_BUFFER_SIZE) {
+        length = LEVEL_BUFFER_SIZE;
+    }
+    memcpy(s->buffer, s->memory + s->memory_used, length);
+    s->memory_used += length;
+    return length;
+}
+
+static void put_bits(BitStream *s, uint32 value, int count) {
+    s->bits |= (uint64)(value & (uint32)((1ull << count) - 1)) << s->count;
+    s->count += count;
+    while (s->count >= 8) {
+        if (s->length == LEVEL_BUFFER_SIZE) {
+            flush_bit_stream(s);
+        }
+        s->buffer[s->length++] = (uint8)s->bits;
+        s->bits >>= 8;
+        s->count -= 8;
+    }
+}
+
+// pads the last byte with zeros and writes out whatever is buffered
+static void finish_bit_stream(BitStream *s) {
+    if (s->count > 0) {
+        put_bits(s, 0, 8 - s->count);
+    }
+    flush_bit_stream(s);
+}
+
+// reading past the end of the file gives zeros and marks the stream failed
+static uint32 get_bits(BitStream *s, int count) {
+    while (s->count < count) {
+        if (s->position == s->length) {
+            s->length = fill_bit_stream(s);
+            s->position = 0;
+            if (s->length == 0) {
+                s->failed = true;
+                return 0;
+            }
+        }
+        s->bits |= (uint64)s->buffer[s->position++] << s->count;
+        s->count += 8;
+    }
+    uint32 value = (uint32)(s->bits & ((1ull << count) - 1));
+    s->bits >>= count;
+    s->count -= count;
+    return value;
+}
+
+// INVALID_CELL is common enough to be worth storing, so coordinates are +1
+static void put_level_cell(BitStream *s, Cell cell) {
+    put_bits(s, cell.x + 1, LEVEL_COORD_BITS);
+    put_bits(s, cell.y + 1, LEVEL_COORD_BITS);
+}
+
+static Cell get_level_cell(BitStream *s) {
+    int x = (int)get_bits(s, LEVEL_COORD_BITS) - 1;
+    int y = (int)get_bits(s, LEVEL_COORD_BITS) - 1;
+    return (Cell) { x, y };
+}
+
+static void put_level_creature(BitStream *s, Creature *c) {
+    put_bits(s, c->type, 2);
+    put_bits(s, c->flags, 2);
+    put_bits(s, c->direction, 2);
+    put_level_cell(s, c->position);
+    put_level_cell(s, c->previous_position);
+    put_level_cell(s, c->last_known_player_location);
+    put_bits(s, c->random, 32);
+}
+
+static void get_level_creature(BitStream *s, Creature *c) {
+    c->type = get_bits(s, 2);
+    c->flags = get_bits(s, 2);
+    c->direction = get_bits(s, 2);
+    c->position = get_level_cell(s);
+    c->previous_position = get_level_cell(s);
+    c->last_known_player_location = get_level_cell(s);
+    c->random = get_bits(s, 32);
+}
+
+static inline bool is_creature_in_bounds(State *state, Creature *c) {
+    return !is_cell_out_of_bounds(state, c->position) && !is_cell_out_of_bounds(state, c->previous_position);
+}
+
+static void put_grid_row(BitStream *s, Level *level, int y) {
+    int x = 0;
+    while (x < GRID_WIDTH) {
+        uint8 flags = level->grid[x][y];
+        int run = 1;
+        while (x + run < GRID_WIDTH && level->grid[x + run][y] == flags) {
+            run++;
+        }
+        put_bits(s, flags, LEVEL_FLAG_BITS);
+        put_bits(s, run - 1, LEVEL_COORD_BITS);
+        x += run;
+    }
+}
+
+static bool get_grid_row(BitStream *s, Level *level, int y) {
+    int x = 0;
+    while (x < GRID_WIDTH && !s->failed) {
+        uint8 flags = get_bits(s, LEVEL_FLAG_BITS);
+        int run = get_bits(s, LEVEL_COORD_BITS) + 1;
+        if (x + run > GRID_WIDTH) {
+            return false;
+        }
+        for (int end = x + run; x < end; x++) {
+            level->grid[x][y] = flags;
+        }
+    }
+    return !s->failed;
+}
+
+#define LEVEL_CREATURE_BITS (6 + (6 * LEVEL_COORD_BITS) + 32)
+
+// upper bound of what put_level_state writes, in bytes
+size_t get_level_state_bound(void) {
+    size_t bits = (
+        (4 * 32) + LEVEL_DEPTH_BITS + 8 + (2 * LEVEL_COORD_BITS) +
+        ((CREATURE_CAPACITY + 1) * LEVEL_CREATURE_BITS) +
+        LEVEL_INDEX_BITS + (CREATURE_CAPACITY * (LEVEL_INDEX_BITS + LEVEL_DELAY_BITS))
+    );
+    return (bits + 7) / 8;
+}
+
+// copies everything put_level_state writes out of the game, the grid is left
+// to the caller
+void capture_level_state(State *state, Level *level) {
+    level->seed = state->seed;
+    level->depth = state->depth;
+    level->random = state->random;
+    level->turn = state->turn;
+    level->now = state->schedule.now;
+    level->flags = state->flags;
+    level->mouse_target = state->mouse_target;
+    level->player = state->player;
+    memcpy(level->creatures, state->creatures, sizeof(level->creatures));
+
+    // walked in the order schedule_take would hand the creatures out
+    Schedule *schedule = &state->schedule;
+    level->schedule_count = 0;
+    for (int k = 0; k < SCHEDULE_SLOTS; k++) {
+        int slot = (schedule->now + k) % SCHEDULE_SLOTS;
+        for (int i = schedule->slots[slot]; i != NO_CREATURE; i = schedule->next[i]) {
+            level->schedule_order[level->schedule_count] = i;
+            level->schedule_time[level->schedule_count] = schedule->action_time[i];
+            level->schedule_count++;
+        }
+    }
+}
+
+// the game, creature and schedule sections, shared with the world file
+void put_level_state(BitStream *s, Level *level) {
+    put_bits(s, level->seed, 32);
+    put_bits(s, level->depth, LEVEL_DEPTH_BITS);
+    put_bits(s, level->random, 32);
+    put_bits(s, level->turn, 32);
+    put_bits(s, level->now, 32);
+    put_bits(s, level->flags, 8);
+    put_level_cell(s, level->mouse_target);
+
+    put_level_creature(s, &level->player);
+    for (int i = 0; i < CREATURE_CAPACITY; i++) {
+        put_level_creature(s, &level->creatures[i]);
+    }
+
+    put_bits(s, level->schedule_count, LEVEL_INDEX_BITS);
+    for (int i = 0; i < level->schedule_count; i++) {
+        put_bits(s, level->schedule_order[i], LEVEL_INDEX_BITS);
+        put_bits(s, level->schedule_time[i] - level->now, LEVEL_DELAY_BITS);
+    }
+}
+
+static void put_level(BitStream *s, Level *level) {
+    put_bits(s, LEVEL_MAGIC, 32);
+    put_bits(s, LEVEL_VERSION, 32);
+    put_bits(s, GRID_WIDTH, 16);
+    put_bits(s, GRID_HEIGHT, 16);
+    put_bits(s, CREATURE_CAPACITY, LEVEL_INDEX_BITS);
+    put_level_state(s, level);
+    for (int y = 0; y < GRID_HEIGHT; y++) {
+        put_grid_row(s, level, y);
+    }
+    finish_bit_stream(s);
+}
+
+// upper bound of a whole level file in bytes, every cell a run of its own
+size_t get_level_bound(void) {
+    size_t grid_bits = (size_t)GRID_BYTES * (LEVEL_FLAG_BITS + LEVEL_COORD_BITS);
+    return 16 + get_level_state_bound() + ((grid_bits + 7) / 8);
+}
+
+// encodes a level that was captured earlier, so it can run on another thread
+// while the game goes on
+bool write_level(FILE *file, Level *level) {
+    BitStream *s = (BitStream *)malloc(sizeof(BitStream));
+    open_bit_stream(s, file);
+    put_level(s, level);
+    bool ok = !s->failed;
+    free(s);
+    return ok;
+}
+
+// encodes a level into memory as it would be in a file, returns the bytes
+// used or 0 when size was not enough
+size_t pack_level(Level *level, uint8 *memory, size_t size) {
+    BitStream *s = (BitStream *)malloc(sizeof(BitStream));
+    open_memory_bit_stream(s, memory, size);
+    put_level(s, level);
+    size_t used = s->failed ? 0 : s->memory_used;
+    free(s);
+    return used;
+}
+
+bool save_level(State *state, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    Level *level = (Level *)malloc(sizeof(Level));
+    capture_level_state(state, level);
+    memcpy(level->grid, state->grid, sizeof(level->grid));
+    bool ok = write_level(file, level);
+    free(level);
+    return (fclose(file) == 0) && ok;
+}
+
+bool get_level_state(BitStream *s, State *state, Level *level) {
+    level->seed = get_bits(s, 32);
+    level->depth = get_bits(s, LEVEL_DEPTH_BITS);
+    level->random = get_bits(s, 32);
+    level->turn = get_bits(s, 32);
+    level->now = get_bits(s, 32);
+    level->flags = get_bits(s, 8);
+    level->mouse_target = get_level_cell(s);
+
+    get_level_creature(s, &level->player);
+    if (!is_creature_in_bounds(state, &level->player)) {
+        return false;
+    }
+    for (int i = 0; i < CREATURE_CAPACITY; i++) {
+        get_level_creature(s, &level->creatures[i]);
+        if (!is_creature_in_bounds(state, &level->creatures[i])) {
+            return false;
+        }
+    }
+
+    level->schedule_count = get_bits(s, LEVEL_INDEX_BITS);
+    if (level->schedule_count > CREATURE_CAPACITY) {
+        return false;
+    }
+    for (int i = 0; i < level->schedule_count; i++) {
+        level->schedule_order[i] = get_bits(s, LEVEL_INDEX_BITS);
+        level->schedule_time[i] = level->now + get_bits(s, LEVEL_DELAY_BITS);
+        if (level->schedule_order[i] >= CREATURE_CAPACITY) {
+            return false;
+        }
+    }
+    return !s->failed;
+}
+
+static bool read_level(BitStream *s, State *state, Level *level) {
+    bool header = (
+        get_bits(s, 32) == LEVEL_MAGIC &&
+        get_bits(s, 32) == LEVEL_VERSION &&
+        get_bits(s, 16) == GRID_WIDTH &&
+        get_bits(s, 16) == GRID_HEIGHT &&
+        get_bits(s, LEVEL_INDEX_BITS) == CREATURE_CAPACITY
+    );
+    if (!header || !get_level_state(s, state, level)) {
+        return false;
+    }
+    for (int y = 0; y < GRID_HEIGHT; y++) {
+        if (!get_grid_row(s, level, y)) {
+            return false;
+        }
+    }
+    return !s->failed;
+}
+
+bool unpack_level(State *state, uint8 *memory, size_t size, Level *level) {
+    BitStream *s = (BitStream *)malloc(sizeof(BitStream));
+    open_memory_bit_stream(s, memory, size);
+    bool ok = read_level(s, state, level);
+    free(s);
+    return ok;
+}
+
+// everything but the grid and what is rebuilt from it
+void apply_level_state(State *state, Level *level) {
+    state->seed = level->seed;
+    state->depth = level->depth;
+    state->random = level->random;
+    state->turn = level->turn;
+    state->flags = level->flags;
+    state->mouse_target = level->mouse_target;
+    state->player = level->player;
+    memcpy(state->creatures, level->creatures, sizeof(state->creatures));
+
+    // schedule_add prepends, so adding backwards restores the order
+    schedule_init(&state->schedule);
+    state->schedule.now = level->now;
+    for (int i = level->schedule_count - 1; i >= 0; i--) {
+        schedule_add(&state->schedule, level->schedule_order[i], level->schedule_time[i]);
+    }
+}
+
+// replaces the level of an initialized game. the state is left untouched
+// when the file cannot be read. plans and reservations are not stored, so
+// creatures plan afresh on the first turn after loading
+bool load_level(State *state, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    BitStream *s = (BitStream *)malloc(sizeof(BitStream));
+    Level *level = (Level *)malloc(sizeof(Level));
+    open_bit_stream(s, file);
+    bool ok = read_level(s, state, level);
+    fclose(file);
+    free(s);
+
+    if (ok) {
+        clear_level_cache(state);
+        apply_level_state(state, level);
+        memcpy(state->grid, level->grid, GRID_BYTES);
+        build_neighbour_masks(state);
+        init_creature_chunks(state);
+        reset_cooperative_paths(state);
+        reset_state_hash(state);
+        touch_all_chunks(state);
+        update_game_offset(state);
+        prepare_next_level(state);
+    }
+    free(level);
+    return ok;
+}
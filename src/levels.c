@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+
+// the current level lives in State, every other visited level in the cache.
+// the stairs only ever lead to a neighbour, which is kept unpacked, so taking
+// them copies a level in instead of decoding one. levels further away are
+// packed and, past the budget, written out, the next to the current one are
+// unpacked again whenever the player moves
+
+static CachedLevel *get_cached_level(LevelCache *c, int depth) {
+    if (depth >= c->capacity) {
+        int capacity = (c->capacity > 0) ? c->capacity : 8;
+        while (capacity <= depth) {
+            capacity *= 2;
+        }
+        c->levels = (CachedLevel *)realloc(c->levels, capacity * sizeof(CachedLevel));
+        memset(c->levels + c->capacity, 0, (capacity - c->capacity) * sizeof(CachedLevel));
+        c->capacity = capacity;
+    }
+    return &c->levels[depth];
+}
+
+// a level that cannot be packed stays as it is
+static void pack_cached_level(LevelCache *c, CachedLevel *entry) {
+    size_t bound = get_level_bound();
+    if (!c->scratch) {
+        c->scratch = (uint8 *)malloc(bound);
+    }
+    size_t size = pack_level(entry->level, c->scratch, bound);
+    if (size == 0) {
+        return;
+    }
+    entry->packed = (uint8 *)malloc(size);
+    memcpy(entry->packed, c->scratch, size);
+    entry->packed_size = size;
+    c->packed_bytes += size;
+    free(entry->level);
+    entry->level = 0;
+    c->packs++;
+}
+
+static bool evict_cached_level(LevelCache *c, CachedLevel *entry) {
+    FILE *file = tmpfile();
+    if (!file) {
+        return false;
+    }
+    if (fwrite(entry->packed, 1, entry->packed_size, file) != entry->packed_size || fflush(file) != 0) {
+        fclose(file);
+        return false;
+    }
+    entry->file = file;
+    c->packed_bytes -= entry->packed_size;
+    free(entry->packed);
+    entry->packed = 0;
+    c->evictions++;
+    return true;
+}
+
+// brings a level back as it is, from memory or from its file
+static bool unpack_cached_level(State *state, LevelCache *c, CachedLevel *entry) {
+    if (entry->level) {
+        return true;
+    }
+    if (entry->file) {
+        uint8 *packed = (uint8 *)malloc(entry->packed_size);
+        rewind(entry->file);
+        bool read = fread(packed, 1, entry->packed_size, entry->file) == entry->packed_size;
+        if (!read) {
+            free(packed);
+            return false;
+        }
+        fclose(entry->file);
+        entry->file = 0;
+        entry->packed = packed;
+        c->packed_bytes += entry->packed_size;
+    }
+    Level *level = (Level *)malloc(sizeof(Level));
+    if (!unpack_level(state, entry->packed, entry->packed_size, level)) {
+        free(level);
+        return false;
+    }
+    c->packed_bytes -= entry->packed_size;
+    free(entry->packed);
+    entry->packed = 0;
+    entry->level = level;
+    c->unpacks++;
+    return true;
+}
+
+// keeps the neighbours of depth unpacked and packs the rest, then moves the
+// packed levels left the longest ago out until the others fit the budget
+static void balance_level_cache(State *state, int depth) {
+    LevelCache *c = &state->levels;
+    for (int i = 0; i < c->capacity; i++) {
+        CachedLevel *entry = &c->levels[i];
+        if (!entry->visited || i == depth) {
+            continue;
+        }
+        if (abs(i - depth) <= 1) {
+            unpack_cached_level(state, c, entry);
+        } else if (entry->level) {
+            pack_cached_level(c, entry);
+        }
+    }
+    while (c->packed_bytes > c->budget) {
+        CachedLevel *oldest = 0;
+        for (int i = 0; i < c->capacity; i++) {
+            CachedLevel *entry = &c->levels[i];
+            if (entry->packed && (!oldest || entry->last_used < oldest->last_used)) {
+                oldest = entry;
+            }
+        }
+        if (!oldest || !evict_cached_level(c, oldest)) {
+            break;
+        }
+    }
+}
+
+// like load_level, except that the turn count goes on
+static void enter_cached_level(State *state, Level *level) {
+    uint32 turn = state->turn;
+    apply_level_state(state, level);
+    state->turn = turn;
+    state->flags &= ~GAME_FLAG_IS_MOVING;
+    memcpy(state->grid, level->grid, GRID_BYTES);
+    build_neighbour_masks(state);
+    init_creature_chunks(state);
+    reset_cooperative_paths(state);
+    reset_state_hash(state);
+    touch_all_chunks(state);
+    update_game_offset(state);
+    discover_visible_cells(state);
+}
+
+// takes the player to the level above or below. the player arrives where
+// they left it, or at the start of a level never visited before. turns before
+// cannot be undone, their cells were in the grid that was left. a world file
+// holds a single level, so world games stay where they are
+void change_level(State *state, int depth) {
+    LevelCache *c = &state->levels;
+    if (depth < 0 || state->world.open) {
+        return;
+    }
+    get_cached_level(c, state->depth + 1);
+    CachedLevel *target = &c->levels[depth];
+    bool cached = target->visited && unpack_cached_level(state, c, target);
+    if (!cached && (depth != state->depth + 1 || !state->generator.running)) {
+        return;
+    }
+
+    CachedLevel *left = &c->levels[state->depth];
+    left->level = (Level *)malloc(sizeof(Level));
+    capture_level_state(state, left->level);
+    memcpy(left->level->grid, state->grid, GRID_BYTES);
+    left->visited = true;
+    left->last_used = ++c->clock;
+
+    forget_undo_turns(&state->undo);
+    if (cached) {
+        enter_cached_level(state, target->level);
+        free(target->level);
+        target->level = 0;
+    } else {
+        take_generated_level(state);
+    }
+    target->visited = true;
+
+    balance_level_cache(state, depth);
+    if (!get_cached_level(c, depth + 1)->visited) {
+        prepare_next_level(state);
+    }
+}
+
+// forgets every level but the current one, for when a different game starts
+void clear_level_cache(State *state) {
+    LevelCache *c = &state->levels;
+    for (int i = 0; i < c->capacity; i++) {
+        CachedLevel *entry = &c->levels[i];
+        free(entry->level);
+        free(entry->packed);
+        if (entry->file) {
+            fclose(entry->file);
+        }
+    }
+    free(c->levels);
+    free(c->scratch);
+    size_t budget = c->budget;
+    *c = (LevelCache) { 0 };
+    c->budget = budget;
+}
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include "../raylib/include/raylib.h"
@@ -8,31 +9,89 @@
 #include "map.c"
 #include "vision.c"
 #include "movement.c"
+#include "jobs.c"
+#include "schedule.c"
+#include "cooperative.c"
+#include "creatures.c"
+#include "undo.c"
+#include "hash.c"
+#include "game.c"
+#include "level.c"
+#include "levels.c"
+#include "platform.c"
+#include "profile.c"
+#include "trace.c"
+#include "work.c"
+#include "world.c"
+#include "autosave.c"
+#include "replay.c"
+#include "sim.c"
+#include "raster.c"
+#include "backend_raylib.c"
+#include "sprites.c"
 #include "renderer.c"
 
-void update_creature_direction(Creature *c) {
-    if (c->previous_position.y > c->position.y) {
-        c->direction = ORTHAGONAL_N;
-    } else if (c->previous_position.x > c->position.x) {
-        c->direction = ORTHAGONAL_W;
-    } else if (c->previous_position.y < c->position.y) {
-        c->direction = ORTHAGONAL_S;
-    } else if (c->previous_position.x < c->position.x) {
-        c->direction = ORTHAGONAL_E;
-    }
-}
-
 void fill_cell(State *state, Cell position) {
-    state->grid[position.x][position.y] &= ~CELL_FLAG_WALKABLE;
-    state->grid[position.x][position.y] |= CELL_FLAG_WALKABLE;
+    remove_cell_flags(state, position, CELL_FLAG_WALKABLE);
+    add_cell_flags(state, position, CELL_FLAG_WALKABLE);
 }
 
-void update_game_offset(State *state) {
-    Cell local_dimensions = { GAME_WIDTH, GAME_HEIGHT };
-    state->game_offset = cell_subtract(state->player.position, cell_divide(local_dimensions, 2));
+// while nothing changes on screen EndDrawing blocks until the next input event
+// instead of presenting the same frame 60 times a second
+void set_event_waiting(bool idle) {
+    if (idle) {
+        EnableEventWaiting();
+    } else {
+        DisableEventWaiting();
+    }
 }
 
-int main(void) {
+// g.exe [--seed N] [--record FILE] [--load FILE] [--world FILE] [--autosave FILE]
+//       [--level-budget BYTES] [--trace FILE]
+// --record writes the seed and every input to FILE on exit, for headless --replay.
+// --load starts from a level saved by headless --save. --world plays on a
+// mapped world file, created from the seed when it does not exist. --autosave
+// saves the level to FILE in the background every AUTOSAVE_INTERVAL turns.
+// --level-budget limits the memory of packed levels before they go to disk.
+// built with -DPROFILE (run.bat p), F3 shows the zone timings and F4 the
+// cells the heaviest recent search expanded. the timings are written to
+// profile.csv and the search histograms to astar.csv on exit. built with
+// -DTRACE (run.bat t), --trace writes a timeline of the session to FILE for
+// chrome://tracing or perfetto
+int main(int argc, char **argv) {
+    bool seeded = false;
+    uint32 seed = 0;
+    const char *record_path = 0;
+    const char *load_path = 0;
+    const char *world_path = 0;
+    const char *autosave_path = 0;
+    const char *trace_path = 0;
+    long level_budget = -1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--seed") == 0) {
+            seed = (uint32)strtoul(argv[i + 1], 0, 10);
+            seeded = true;
+        } else if (strcmp(argv[i], "--record") == 0) {
+            record_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--load") == 0) {
+            load_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--world") == 0) {
+            world_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--autosave") == 0) {
+            autosave_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--level-budget") == 0) {
+            level_budget = atol(argv[i + 1]);
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace_path = argv[i + 1];
+        }
+    }
+
+    // a recording only holds the seed, it replays from the generated level
+    if (record_path && (load_path || world_path)) {
+        printf("--record starts from the seed, it cannot be used with --load or --world\n");
+        return 1;
+    }
+
     const int screen_width = CELLSIZE * GAME_WIDTH;
     const int screen_height = CELLSIZE * GAME_HEIGHT;
 
@@ -44,188 +103,225 @@ int main(void) {
     SetRandomSeed(8);
     #endif
 
-    State *state = (State *)calloc(1, sizeof(State));
+    if (!seeded) {
+        seed = (uint32)GetRandomValue(1, INT_MAX);
+    }
 
-    state->player = (Creature) {
-        .type = CREATURE_PLAYER,
-    };
+    State *state = (State *)calloc(1, sizeof(State));
+    if (!world_path) {
+        init_game(state, seed, WORKER_COUNT);
+    } else if (!open_or_create_world(state, world_path, seed, WORKER_COUNT)) {
+        printf("could not open %s\n", world_path);
+        CloseWindow();
+        free(state);
+        return 1;
+    }
+    if (level_budget >= 0) {
+        state->levels.budget = level_budget;
+    }
+    if (load_path && !load_level(state, load_path)) {
+        printf("could not read %s\n", load_path);
+    }
+    if (record_path) {
+        start_recording(&state->recording, seed);
+    }
+    if (autosave_path && !autosave_start(state, autosave_path)) {
+        printf("cannot autosave to %s\n", autosave_path);
+    }
 
-    state->creatures[0] = (Creature) {
-        .type = CREATURE_EVIL_TRIANGLE,
-        .direction = DIAGONAL_NE,
-    };
-    state->creatures[1] = (Creature) {
-        .type = CREATURE_BIG_EVIL_TRIANGLE,
-        .last_known_player_location = INVALID_CELL,
-    };
+    #if TRACE
+    if (trace_path) {
+        trace_start();
+    }
+    #else
+    if (trace_path) {
+        printf("tracing needs a build with -DTRACE\n");
+    }
+    #endif
 
-    generate_map(state);
+    // from here on the simulation runs on its own thread, this one handles
+    // input, timing and drawing from the snapshots it publishes
+    sim_start(state);
 
-    update_game_offset(state);
-    discover_visible_cells(state);
+    SimCommand input = state->sim.pending;
+    FrameSnapshot *snapshot = acquire_snapshot(&state->sim.snapshots);
+    uint32 shown_turn = snapshot->turn;
+    bool ready_for_update = false;
+    TurnAction action = TURN_ACTION_NONE;
+    uint8 step_direction = ORTHAGONAL_N;
+    Cell click_target = INVALID_CELL;
 
     int input_key = 0;
-    bool player_arrow_key_move = false;
     bool map_view = false;
 
     while (!WindowShouldClose()) {
+        #if PROFILE
+        profile_frame();
+        if (IsKeyPressed(KEY_F3)) {
+            toggle_profile_overlay();
+        }
+        if (IsKeyPressed(KEY_F4)) {
+            toggle_astar_heatmap();
+            state->frame.valid = false;
+        }
+        #endif
+        TRACE_BEGIN("input");
         float frame_time = GetFrameTime();
-        state->mouse_current = screen_to_game_position(state, GetMousePosition());
+        bool input_changed = false;
+        snapshot = acquire_snapshot(&state->sim.snapshots);
+        if (snapshot->turn != shown_turn) {
+            shown_turn = snapshot->turn;
+            state->game_timer = 0.0f;
+            ready_for_update = false;
+        }
+        Cell mouse_current = screen_to_game_position(snapshot->game_offset, GetMousePosition());
 
         if (IsKeyPressed(KEY_M)) {
             map_view = !map_view;
         }
 
         if (map_view) {
-            draw_map_only(state);
+            TRACE_END("input");
+            PROFILE_BEGIN(RENDER);
+            TRACE_BEGIN("render");
+            bool redrawn = draw_map_only(state, snapshot);
+            TRACE_END("render");
+            PROFILE_END(RENDER);
+            set_event_waiting(!redrawn && snapshot->sequence == input.sequence);
             continue;
         }
 
-        bool left_mouse_pressed = IsMouseButtonPressed(MOUSE_BUTTON_LEFT);
-        bool mouse_condition = left_mouse_pressed && cell_neq(
-            astar_path(state, state->player.position, state->mouse_current, CELL_FLAG_PLAYER_WALKABLE),
-            state->player.position
-        );
+        if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+            action = TURN_ACTION_CLICK;
+            click_target = mouse_current;
+        }
 
+        bool arrow_pressed = true;
         if (IsKeyPressed(KEY_UP)) {
             input_key = KEY_UP;
-            player_arrow_key_move = true;
-            state->key_repeat_timer = 0.0f;
+            step_direction = ORTHAGONAL_N;
         } else if (IsKeyPressed(KEY_LEFT)) {
             input_key = KEY_LEFT;
-            player_arrow_key_move = true;
-            state->key_repeat_timer = 0.0f;
+            step_direction = ORTHAGONAL_W;
         } else if (IsKeyPressed(KEY_DOWN)) {
             input_key = KEY_DOWN;
-            player_arrow_key_move = true;
-            state->key_repeat_timer = 0.0f;
+            step_direction = ORTHAGONAL_S;
         } else if (IsKeyPressed(KEY_RIGHT)) {
             input_key = KEY_RIGHT;
-            player_arrow_key_move = true;
-            state->key_repeat_timer = 0.0f;
-        } else if (IsKeyDown(input_key)) {
-            if (state->key_repeat_timer < KEY_REPEAT_THRESHOLD) {
-                state->key_repeat_timer += frame_time;
-            } else {
-                player_arrow_key_move = true;
+            step_direction = ORTHAGONAL_E;
+        } else {
+            arrow_pressed = false;
+            if (IsKeyDown(input_key)) {
+                if (state->key_repeat_timer < KEY_REPEAT_THRESHOLD) {
+                    state->key_repeat_timer += frame_time;
+                } else {
+                    action = TURN_ACTION_STEP;
+                }
             }
         }
-
-        if (mouse_condition) {
-            state->mouse_target = state->mouse_current;
+        if (arrow_pressed) {
+            action = TURN_ACTION_STEP;
+            state->key_repeat_timer = 0.0f;
         }
 
-        bool wait = IsKeyPressed(KEY_SPACE);
-        if (mouse_condition || player_arrow_key_move || wait) {
-            state->flags |= GAME_FLAG_IS_MOVING;
+        if (IsKeyPressed(KEY_SPACE)) {
+            action = TURN_ACTION_WAIT;
+        }
+        if (IsKeyPressed(KEY_BACKSPACE)) {
+            action = TURN_ACTION_UNDO;
         }
 
         state->animation_timer += frame_time;
         if (state->animation_timer >= TIME_PER_ANIMATION) {
-            state->animation_timer -= TIME_PER_ANIMATION;
+            state->animation_timer = fmodf(state->animation_timer, TIME_PER_ANIMATION);
         }
 
         if (state->game_timer < TIME_PER_TURN) {
             state->game_timer += frame_time;
         }
-        if (state->game_timer > TIME_PER_TURN && !has_flag(state->flags, GAME_FLAG_READY_FOR_UPDATE)) {
+        if (state->game_timer > TIME_PER_TURN && !ready_for_update) {
             state->game_timer = TIME_PER_TURN;
-            state->flags |= GAME_FLAG_READY_FOR_UPDATE;
-            for (int i = 0; i < CREATURE_CAPACITY; i++) {
-                Creature *c = &state->creatures[i];
-                bool creature_visible = has_flag(c->flags, CREATURE_FLAG_VISIBLE);
-                bool cell_visible = has_flag(state->grid[c->position.x][c->position.y], CELL_FLAG_VISIBLE);
-                if (creature_visible && !cell_visible) {
-                    c->flags &= ~CREATURE_FLAG_VISIBLE;
-                }
-            }
+            ready_for_update = true;
+            input.settle++;
+            input_changed = true;
         }
 
-        if (has_flag(state->flags, GAME_FLAG_READY_FOR_UPDATE | GAME_FLAG_IS_MOVING)) {
-            state->flags &= ~GAME_FLAG_READY_FOR_UPDATE;
-            state->game_timer = 0.0f;
-
-            state->player.previous_position = state->player.position;
-
-            if (wait) {
-                state->flags &= ~GAME_FLAG_IS_MOVING;
-            } else {
-                if (player_arrow_key_move) {
-                    state->flags &= ~GAME_FLAG_IS_MOVING;
-                    Cell requested_cell = state->player.previous_position;
-                    switch (input_key) {
-                    case KEY_UP: requested_cell.y--; break;
-                    case KEY_LEFT: requested_cell.x--; break;
-                    case KEY_DOWN: requested_cell.y++; break;
-                    case KEY_RIGHT: requested_cell.x++; break;
-                    }
-                    if (is_cell_valid(state, requested_cell, CELL_FLAG_WALKABLE)) {
-                        state->player.position = requested_cell;
-                    }
-                    player_arrow_key_move = false;
-                } else {
-                    state->player.position = astar_path(state, state->player.previous_position, state->mouse_target, CELL_FLAG_PLAYER_WALKABLE);
-                    if (cell_eq(state->player.position, state->mouse_target)) {
-                        state->flags &= ~GAME_FLAG_IS_MOVING;
-                    }
-                }
-                update_creature_direction(&state->player);
-
-                set_invisible(state);
-                update_game_offset(state);
-                discover_visible_cells(state);
-            }
-
-            for (int i = 0; i < CREATURE_CAPACITY; i++) {
-                Creature *c = &state->creatures[i];
-                c->previous_position = c->position;
-                Cell old_pos = c->previous_position;
-                state->grid[old_pos.x][old_pos.y] &= ~CELL_FLAG_CREATURE;
-                Cell new_pos = old_pos;
-                switch (c->type) {
-                case CREATURE_DIGGER: {
-                    new_pos = random_wander(state, old_pos, c->direction);
-                } break;
-                case CREATURE_EVIL_TRIANGLE: {
-                    CoordAndDirection cad = bounce_path(state, old_pos, c->direction);
-                    new_pos = cad.coord;
-                    c->direction = cad.direction;
-                } break;
-                case CREATURE_BIG_EVIL_TRIANGLE: {
-                    if (cell_neq(c->last_known_player_location, INVALID_CELL)) {
-                        new_pos = astar_path(state, old_pos, c->last_known_player_location, CELL_FLAG_CREATURE_WALKABLE);
-                        if (cell_eq(new_pos, old_pos)) {
-                            c->last_known_player_location = INVALID_CELL;
-                        }
-                    }
-                    if (cell_eq(new_pos, old_pos)) {
-                        new_pos = random_wander(state, old_pos, c->direction);
-                    }
-
-                    bool can_see_player = has_flag(state->grid[new_pos.x][new_pos.y], CELL_FLAG_VISIBLE);
-                    if (can_see_player) {
-                        c->last_known_player_location = state->player.position;
-                    }
-                    update_creature_direction(c);
-                } break;
-                }
-                c->position = new_pos;
-                state->grid[new_pos.x][new_pos.y] |= CELL_FLAG_CREATURE;
-                bool creature_visible = has_flag(c->flags, CREATURE_FLAG_VISIBLE);
-                bool cell_visible = has_flag(state->grid[c->position.x][c->position.y], CELL_FLAG_VISIBLE);
-                if (!creature_visible && cell_visible) {
-                    c->flags |= (CREATURE_FLAG_DISCOVERED | CREATURE_FLAG_VISIBLE);
-                    state->flags &= ~GAME_FLAG_IS_MOVING;
-                }
-            }
+        // one turn request at a time, the next one waits until a snapshot
+        // shows that the simulation has resolved the previous
+        bool turn_in_flight = snapshot->sequence != input.sequence;
+        if (action == TURN_ACTION_NONE && has_flag(snapshot->flags, GAME_FLAG_IS_MOVING)) {
+            action = TURN_ACTION_CONTINUE;
+        }
+        bool request_turn = ready_for_update && !turn_in_flight && action != TURN_ACTION_NONE;
+        if (request_turn) {
+            input_changed = true;
+            input.sequence++;
+            input.action = action;
+            input.direction = step_direction;
+            input.target = click_target;
+            action = TURN_ACTION_NONE;
+        }
+        if (input_changed || cell_neq(input.mouse_current, mouse_current)) {
+            input.mouse_current = mouse_current;
+            sim_send(&state->sim, &input);
         }
         state->turn_time = (state->game_timer / TIME_PER_TURN) * CELLSIZE;
+        TRACE_END("input");
+
+        PROFILE_BEGIN(RENDER);
+        TRACE_BEGIN("render");
+        bool redrawn = render(state, snapshot);
+        TRACE_END("render");
+        PROFILE_END(RENDER);
+        bool idle = (
+            !redrawn &&
+            !has_flag(snapshot->flags, GAME_FLAG_IS_MOVING) &&
+            !IsKeyDown(input_key) &&
+            ready_for_update &&
+            action == TURN_ACTION_NONE &&
+            snapshot->sequence == input.sequence &&
+            snapshot->settle == input.settle &&
+            cell_eq(snapshot->mouse_current, input.mouse_current)
+        );
+        set_event_waiting(idle);
+    }
+
+    sim_stop(state);
 
-        render(state);
+    #if PROFILE
+    if (!write_profile_csv("profile.csv")) {
+        printf("could not write profile.csv\n");
     }
+    if (!write_astar_csv("astar.csv")) {
+        printf("could not write astar.csv\n");
+    }
+    #endif
 
+    if (!autosave_stop(state)) {
+        printf("could not write %s\n", autosave_path);
+    }
+    if (record_path && !save_recording(&state->recording, record_path)) {
+        printf("could not write %s\n", record_path);
+    }
+    free_recording(&state->recording);
+    if (!close_world(state)) {
+        printf("could not write %s\n", world_path);
+    }
+
+    if (state->tiles.loaded) {
+        gfx_unload_image(state->tiles.image);
+    }
+    unload_sprite_atlas(&state->sprites);
+    unload_map_overview(&state->overview);
+    unload_frame_cache(&state->frame);
     CloseWindow();
 
+    deinit_game(state);
+    #if TRACE
+    if (trace_path && !trace_stop(trace_path)) {
+        printf("could not write %s\n", trace_path);
+    }
+    #endif
     free(state);
 
     return 0;
@@ -2,7 +2,9 @@
 #define MAIN_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include <math.h>
+#include <pthread.h>
 #include "../raylib/include/raylib.h"
 
 #define GRID_WIDTH 128
@@ -15,19 +17,65 @@
 #define HALF_CELLSIZE (CELLSIZE / 2)
 #define SCREEN_WIDTH (CELLSIZE * GRID_WIDTH)
 #define SCREEN_HEIGHT (CELLSIZE * GRID_HEIGHT)
+// crowd.sh raises it past CREATURES_PER_JOB so the creatures are planned in
+// parallel batches
+#ifndef CREATURE_CAPACITY
 #define CREATURE_CAPACITY 2
+#endif
+#define WORKER_CAPACITY 8
+#define WORKER_COUNT 4
+#define CREATURES_PER_JOB 32
+#define CHUNK_SIZE 16
+#define CHUNK_COLUMNS (GRID_WIDTH / CHUNK_SIZE)
+#define CHUNK_ROWS (GRID_HEIGHT / CHUNK_SIZE)
+#define CHUNK_AMOUNT (CHUNK_COLUMNS * CHUNK_ROWS)
+#define LOD_FULL_MARGIN 8
+#define LOD_COARSE_MARGIN 40
+#define LOD_COARSE_INTERVAL 4
+#define NO_CREATURE -1
+#define MAP_LEVELS 8
+#define GFX_IMAGE_CAPACITY 8
+#define SNAPSHOT_FRESH 4
+#define SPRITE_SIZE (CELLSIZE * 2)
+#define SPRITE_TYPES 4
+#define SPRITE_ANIMATION_FRAMES 16
+#define SPRITE_EYE_VARIANTS 5
+#define PATH_PREVIEW_CAPACITY (GAME_WIDTH * GAME_HEIGHT)
+#define SCHEDULE_SLOTS 128
+#define ACTION_COST 12
+#define RESERVATION_WINDOW 16
+#define RESERVATION_LAYERS 32
+#define RESERVATION_LAYER_CAPACITY 1024
+#define SPACE_TIME_NODE_CAPACITY 8192
 #define TIME_PER_TURN 0.05f
 #define TIME_PER_ANIMATION 0.4f
 #define KEY_REPEAT_THRESHOLD 0.3f
 #define NO_DIRECTION 255
 #define INVALID_CELL ((Cell) { -1, -1 })
 #define ROOM_CAPACITY 100
+#define GRID_BYTES (GRID_WIDTH * GRID_HEIGHT)
+#define HASH_SLOT_PLAYER CREATURE_CAPACITY
+#define LEVEL_BUFFER_SIZE 4096
+#define WORLD_PAGE_SIZE 4096
+#define WORLD_CHUNK_BYTES (CHUNK_SIZE * CHUNK_SIZE)
+#define UNDO_TURN_CAPACITY 256
+#define UNDO_CELL_CAPACITY (1 << 16)
+#define UNDO_CREATURE_CAPACITY 4096
+#define AUTOSAVE_INTERVAL 50
+#define AUTOSAVE_PATH_CAPACITY 512
+#define LEVEL_CACHE_BUDGET (1 << 20)
+#define PROFILE_FRAMES 256
+#define ASTAR_HISTOGRAM_BUCKETS 16
+#define TRACE_CAPACITY (1 << 20)
+#define TRACE_THREADS 32
 
 #define COLOR_UNDISCOVERED ((Color){0,0,0,255})
 #define COLOR_GROUND_VISIBLE ((Color){0,32,64,255})
 #define COLOR_GROUND_INVISIBLE ((Color){16,16,16,255})
 #define COLOR_WALL_VISIBLE ((Color){0,64,128,255})
 #define COLOR_WALL_INVISIBLE ((Color){32,32,32,255})
+#define COLOR_STAIRS_VISIBLE ((Color){160,128,0,255})
+#define COLOR_STAIRS_INVISIBLE ((Color){64,56,32,255})
 #define COLOR_PLAYER_PATH ((Color){0,255,0,64})
 #define COLOR_CREATURE_PLAYER ((Color){0,128,255,255})
 #define COLOR_CREATURE_ENEMY ((Color){255,128,0,255})
@@ -35,6 +83,8 @@
 
 typedef uint8_t uint8;
 typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
 
 enum StateFlags {
     GAME_FLAG_READY_FOR_UPDATE = 1 << 0,
@@ -55,6 +105,17 @@ enum Diagonal {
     DIAGONAL_SE,
 };
 
+enum Neighbour {
+    NEIGHBOUR_N,
+    NEIGHBOUR_W,
+    NEIGHBOUR_S,
+    NEIGHBOUR_E,
+    NEIGHBOUR_NE,
+    NEIGHBOUR_NW,
+    NEIGHBOUR_SW,
+    NEIGHBOUR_SE,
+};
+
 enum CellFlags {
     CELL_FLAG_ANY = 0,
     CELL_FLAG_DISCOVERED = 1 << 0,
@@ -62,6 +123,8 @@ enum CellFlags {
     CELL_FLAG_WALKABLE = 1 << 2,
     CELL_FLAG_WALL = 1 << 3,
     CELL_FLAG_CREATURE = 1 << 4,
+    CELL_FLAG_STAIRS = 1 << 5,
+    CELL_FLAG_STAIRS_UP = 1 << 6,
 
     CELL_FLAG_PLAYER_WALKABLE = (CELL_FLAG_WALKABLE | CELL_FLAG_DISCOVERED),
     CELL_FLAG_CREATURE_WALKABLE = (CELL_FLAG_WALKABLE),
@@ -79,6 +142,10 @@ Cell cell_subtract(Cell a, Cell b) { return (Cell) { (a.x - b.x), (a.y) - b.y };
 Cell cell_multiply(Cell a, int factor) { return (Cell) { (a.x * factor), (a.y) * factor }; }
 Cell cell_divide(Cell a, int divisor) { return (Cell) { (a.x / divisor), (a.y) / divisor }; }
 
+// a level's cells, GRID_WIDTH columns of GRID_HEIGHT. held through a pointer
+// so changing levels swaps buffers instead of copying them
+typedef uint8 (*Grid)[GRID_HEIGHT];
+
 typedef struct Room {
     Cell position;
     Cell size;
@@ -109,14 +176,76 @@ typedef struct ANode {
     struct ANode *came_from;
 } ANode;
 
+// after a search the closed list holds the cells it expanded, path_length is
+// -1 when the goal was unreachable
 typedef struct AStar {
     ANode all_list[GRID_WIDTH][GRID_HEIGHT];
     int open_list_count;
     ANode* open_list[CELLAMOUNT];
     int closed_list_count;
     ANode* closed_list[CELLAMOUNT];
+    int peak_open_count;
+    int path_length;
 } AStar;
 
+// where a search was asked for, to tell the searches apart in the statistics
+typedef enum AStarSite {
+    ASTAR_SITE_CLICK,
+    ASTAR_SITE_MOVE,
+    ASTAR_SITE_PREVIEW,
+    ASTAR_SITE_CHASE,
+    ASTAR_SITE_COUNT,
+} AStarSite;
+
+#if PROFILE
+typedef struct AStarRecord {
+    AStarSite site;
+    Cell start;
+    Cell goal;
+    int expanded;
+    int peak_open;
+    int path_length;
+    float ms;
+} AStarRecord;
+#endif
+
+// window of a chaser's cooperative path, cells[k] is where the creature
+// stands after its (k + 1)th action counted from start_time
+typedef struct CooperativePath {
+    Cell goal;
+    uint32 start_time;
+    int cost;
+    int length;
+    int step;
+    Cell cells[RESERVATION_WINDOW];
+} CooperativePath;
+
+// one layer of the space-time reservation table covers ACTION_COST ticks,
+// layers are recycled once the schedule has moved past them
+typedef struct ReservationLayer {
+    uint32 time;
+    uint32 cells[RESERVATION_LAYER_CAPACITY];
+    int owners[RESERVATION_LAYER_CAPACITY];
+} ReservationLayer;
+
+typedef struct SpaceTimeNode {
+    Cell position;
+    int step;
+    int f_cost;
+    int came_from;
+} SpaceTimeNode;
+
+typedef struct SpaceTimeSearch {
+    Cell distance_goal;
+    int distance[GRID_WIDTH][GRID_HEIGHT];
+    Cell queue[CELLAMOUNT];
+    uint32 visited_steps[GRID_WIDTH][GRID_HEIGHT];
+    int node_count;
+    SpaceTimeNode nodes[SPACE_TIME_NODE_CAPACITY];
+    int open_count;
+    int open[SPACE_TIME_NODE_CAPACITY];
+} SpaceTimeSearch;
+
 typedef enum CreatureType {
     CREATURE_PLAYER,
     CREATURE_DIGGER,
@@ -124,6 +253,12 @@ typedef enum CreatureType {
     CREATURE_BIG_EVIL_TRIANGLE,
 } CreatureType;
 
+typedef enum SimTier {
+    SIM_TIER_FULL,
+    SIM_TIER_COARSE,
+    SIM_TIER_DORMANT,
+} SimTier;
+
 enum CreatureFlags {
     CREATURE_FLAG_NONE,
     CREATURE_FLAG_DISCOVERED = 1 << 0,
@@ -136,30 +271,446 @@ typedef struct Creature {
     Cell previous_position;
     Cell position;
     uint16 direction;
+    uint32 random;
     union {
         Cell last_known_player_location;
     };
 } Creature;
 
-typedef struct State {
+// a level as generate_map leaves it. the generator thread fills one of these
+// into a grid buffer of its own, from a random stream of its own
+typedef struct LevelGen {
+    uint32 seed;
+    int depth;
+    uint32 random;
+    Creature player;
+    Creature creatures[CREATURE_CAPACITY];
+    Cell stairs;
+    Grid grid;
+} LevelGen;
+
+// zobrist-style fingerprint kept up to date on every grid write and creature
+// change. each cell and creature contributes a key derived from what it is,
+// where it is and its value, and a change xors the old key out and the new in
+typedef struct StateHash {
+    uint64 grid;
+    uint64 creatures;
+    uint64 creature_keys[CREATURE_CAPACITY + 1];
+} StateHash;
+
+typedef struct MappedFile {
+    uint8 *data;
+    size_t size;
+    int fd;
+    void *file;
+    void *mapping;
+} MappedFile;
+
+// a world file mapped into memory. a chunk is copied into the grid the first
+// time the viewport comes near it, and copied back when the grid changed it
+typedef struct World {
+    bool open;
+    MappedFile file;
+    uint8 *index;
+    uint8 *chunks;
+    uint8 *state;
+    size_t state_size;
+    bool resident[CHUNK_AMOUNT];
+    bool dirty[CHUNK_AMOUNT];
+} World;
+
+typedef struct UndoCell {
+    uint16 x;
+    uint16 y;
+    uint8 flags;
+} UndoCell;
+
+// a creature as it was before a turn touched it, with its schedule entry.
+// the player has none
+typedef struct UndoCreature {
+    int slot;
+    Creature creature;
+    bool scheduled;
+    uint32 action_time;
+    int next;
+} UndoCreature;
+
+// where a turn's changes start in the rings and the small state it overwrote
+typedef struct UndoTurn {
+    uint32 cell_start;
+    uint32 creature_start;
+    uint32 random;
+    uint32 turn;
+    uint32 now;
+    int flags;
+    Cell mouse_target;
     Cell game_offset;
+    int slots[SCHEDULE_SLOTS];
+} UndoTurn;
+
+// ring buffers of what each of the recent turns overwrote. the counters only
+// grow and are taken modulo the capacities, a turn can be undone while none
+// of its entries have been overwritten yet. a stamp equal to turn_count means
+// the cell or creature was already saved during the open turn
+typedef struct UndoLog {
+    bool restoring;
+    uint32 turn_count;
+    uint32 first_turn;
+    uint32 cell_count;
+    uint32 creature_count;
+    UndoTurn turns[UNDO_TURN_CAPACITY];
+    UndoCell cells[UNDO_CELL_CAPACITY];
+    UndoCreature creatures[UNDO_CREATURE_CAPACITY];
+    uint32 cell_stamps[GRID_WIDTH][GRID_HEIGHT];
+    uint32 creature_stamps[CREATURE_CAPACITY + 1];
+} UndoLog;
+
+typedef struct ActiveCreature {
+    int index;
+    SimTier tier;
+    bool blocked;
+} ActiveCreature;
+
+typedef struct CreatureChunks {
+    int head[CHUNK_AMOUNT];
+    int next[CREATURE_CAPACITY];
+    int previous[CREATURE_CAPACITY];
+} CreatureChunks;
+
+// timing wheel keyed on the tick of each creature's next action, every delay
+// is shorter than SCHEDULE_SLOTS so a slot only ever holds a single tick
+typedef struct Schedule {
+    uint32 now;
+    int slots[SCHEDULE_SLOTS];
+    int next[CREATURE_CAPACITY];
+    uint32 action_time[CREATURE_CAPACITY];
+    bool scheduled[CREATURE_CAPACITY];
+} Schedule;
+
+typedef void (*JobFunction)(void *data, int start, int end, int worker);
+
+typedef struct WorkerStart {
+    struct Workers *workers;
+    int index;
+} WorkerStart;
+
+typedef struct Workers {
+    int count;
+    pthread_t threads[WORKER_CAPACITY];
+    WorkerStart starts[WORKER_CAPACITY];
+    AStar *a_star[WORKER_CAPACITY];
+    pthread_mutex_t mutex;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    JobFunction function;
+    void *data;
+    int item_count;
+    int batch_size;
+    int next_item;
+    int busy_count;
+    int generation;
+    bool quit;
+} Workers;
+
+// viewport tile colours, one pixel per cell, drawn with a single scaled blit
+typedef struct TileLayer {
+    bool loaded;
+    uint32 turn;
+    Cell offset;
+    int image;
+} TileLayer;
+
+// one row per creature type: SPRITE_ANIMATION_FRAMES body frames covering
+// TIME_PER_ANIMATION, then the eye for each direction and one looking ahead.
+// every sprite is SPRITE_SIZE square with the creature centered in it
+typedef struct SpriteAtlas {
+    bool loaded;
+    int image;
+} SpriteAtlas;
+
+typedef struct Canvas {
+    int width;
+    int height;
+    Color *pixels;
+} Canvas;
+
+// whole-grid overview for the map view with a downsampled pyramid, level k has
+// one pixel per 2^k x 2^k cells. chunks are refreshed when their version moves
+typedef struct MapOverview {
+    bool loaded;
+    int level;
+    int image;
+    uint32 chunk_versions[CHUNK_AMOUNT];
+    Color *levels[MAP_LEVELS];
+    Color upload[CHUNK_SIZE * CHUNK_SIZE];
+} MapOverview;
+
+// everything a presented frame depends on, the frame is only redrawn when
+// this changes. animation_frame stays zero while nothing animated is on screen
+typedef struct FrameKey {
+    bool map_view;
+    uint32 version;
+    float turn_time;
+    int animation_frame;
+} FrameKey;
+
+// the frame itself is kept by the backend, this only remembers what it shows
+typedef struct FrameCache {
+    bool valid;
+    FrameKey key;
+} FrameCache;
+
+typedef struct CreatureSnapshot {
+    CreatureType type;
+    uint16 direction;
+    Cell previous_position;
+    Cell position;
+} CreatureSnapshot;
+
+// what the renderer needs from the simulation, written by the simulation
+// thread and never touched again once published. version changes with every
+// publish, sequence and settle echo the last input the simulation handled
+typedef struct FrameSnapshot {
+    uint32 version;
+    uint32 sequence;
+    uint32 settle;
+    uint32 turn;
     int flags;
+    Cell game_offset;
     Cell mouse_current;
+    bool mouse_reachable;
+    int path_length;
+    Cell path[PATH_PREVIEW_CAPACITY];
+    CreatureSnapshot player;
+    int creature_count;
+    CreatureSnapshot creatures[CREATURE_CAPACITY];
+    Color tiles[GAME_WIDTH * GAME_HEIGHT];
+    #if PROFILE
+    // the heaviest search since the previous snapshot, heat is the order in
+    // which it expanded each viewport cell scaled to 1 to 255, 0 where it did not
+    AStarRecord astar_search;
+    uint8 astar_heat[GAME_WIDTH * GAME_HEIGHT];
+    #endif
+    // the grid as of grid_version for the map overview, kept up to date chunk
+    // by chunk. a snapshot has to start zeroed for grid_captured to be false
+    bool grid_captured;
+    uint32 grid_version;
+    uint32 chunk_versions[CHUNK_AMOUNT];
+    uint8 grid[GRID_WIDTH][GRID_HEIGHT];
+} FrameSnapshot;
+
+// lock-free triple buffer, the writer and the reader each own one slot and
+// swap it with the middle one. SNAPSHOT_FRESH marks a middle slot that the
+// reader has not taken yet
+typedef struct SnapshotBuffer {
+    FrameSnapshot slots[3];
+    int write;
+    int middle;
+    int read;
+} SnapshotBuffer;
+
+typedef enum TurnAction {
+    TURN_ACTION_NONE,
+    TURN_ACTION_WAIT,
+    TURN_ACTION_STEP,
+    TURN_ACTION_CLICK,
+    TURN_ACTION_CONTINUE,
+    TURN_ACTION_UNDO,
+} TurnAction;
+
+// input from the main thread. every turn request gets a new sequence and every
+// finished turn animation a new settle, the snapshot echoes both once handled
+typedef struct SimCommand {
+    uint32 sequence;
+    uint32 settle;
+    TurnAction action;
+    uint8 direction;
+    Cell target;
+    Cell mouse_current;
+} SimCommand;
+
+typedef struct RecordingEntry {
+    TurnAction action;
+    bool settle;
+    uint8 direction;
+    Cell target;
+    uint64 hash;
+} RecordingEntry;
+
+typedef struct Recording {
+    bool active;
+    uint32 seed;
+    int count;
+    int capacity;
+    RecordingEntry *entries;
+} Recording;
+
+// bit-granular reader or writer over a file or a block of memory, lowest bits
+// first. bytes pass through buffer so a level streams LEVEL_BUFFER_SIZE at a time
+typedef struct BitStream {
+    FILE *file;
+    uint8 *memory;
+    size_t memory_size;
+    size_t memory_used;
+    uint64 bits;
+    int count;
+    int length;
+    int position;
+    bool failed;
+    uint8 buffer[LEVEL_BUFFER_SIZE];
+} BitStream;
+
+// the persistent part of a game as stored in a level file, everything else
+// in State is scratch space or can be rebuilt from this. schedule_order lists
+// the scheduled creatures in the order the schedule would hand them out
+typedef struct Level {
+    uint32 seed;
+    int depth;
+    uint32 random;
+    uint32 turn;
+    uint32 now;
+    int flags;
     Cell mouse_target;
+    Creature player;
+    Creature creatures[CREATURE_CAPACITY];
+    int schedule_count;
+    int schedule_order[CREATURE_CAPACITY];
+    uint32 schedule_time[CREATURE_CAPACITY];
     uint8 grid[GRID_WIDTH][GRID_HEIGHT];
+} Level;
+
+// saves the level every AUTOSAVE_INTERVAL turns without holding up the game.
+// at a turn boundary the simulation thread copies the level into snapshot,
+// only the chunks whose version moved since its previous copy, and hands it
+// to the save thread, which encodes it next to path and replaces path with it.
+// snapshot belongs to the save thread while busy is set, a boundary that finds
+// it busy tries again on the next turn
+typedef struct Autosave {
+    bool running;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    bool quit;
+    bool busy;
+    bool failed;
+    char path[AUTOSAVE_PATH_CAPACITY];
+    char temp_path[AUTOSAVE_PATH_CAPACITY];
+    Level *snapshot;
+    bool captured;
+    uint32 chunk_versions[CHUNK_AMOUNT];
+    uint32 last_turn;
+    int turns;
+    int saves;
+    double capture_ms;
+    double max_capture_ms;
+} Autosave;
+
+// generates the level below the current one while it is played. the
+// simulation thread names the seed and depth it wants next, and when the
+// player takes the stairs waits for done and swaps grids with level. level
+// belongs to the generator thread while done is not set
+typedef struct LevelGenerator {
+    bool running;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    bool quit;
+    bool done;
+    uint32 wanted_seed;
+    int wanted_depth;
+    LevelGen level;
+} LevelGenerator;
+
+// a visited level other than the current one. the levels next to the current
+// one are kept as they are, so taking the stairs only copies them in. the
+// rest are packed in the level format, and once those outgrow the budget the
+// least recently left ones move to a temporary file
+typedef struct CachedLevel {
+    bool visited;
+    Level *level;
+    uint8 *packed;
+    size_t packed_size;
+    FILE *file;
+    uint32 last_used;
+} CachedLevel;
+
+// indexed by depth, grown as the player goes deeper
+typedef struct LevelCache {
+    CachedLevel *levels;
+    int capacity;
+    size_t budget;
+    size_t packed_bytes;
+    uint32 clock;
+    uint8 *scratch;
+    int packs;
+    int unpacks;
+    int evictions;
+} LevelCache;
+
+typedef struct SimThread {
+    bool running;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    bool quit;
+    SimCommand pending;
+    uint32 published;
+    SnapshotBuffer snapshots;
+} SimThread;
+
+// once the simulation thread runs it owns every field up to sim, the main
+// thread only touches sim through its functions and the fields after it
+typedef struct State {
+    uint32 seed;
+    uint32 random;
+    int depth;
+    Cell game_offset;
+    int flags;
+    Cell mouse_current;
+    Cell mouse_target;
+    Grid grid;
+    uint8 neighbours[GRID_WIDTH][GRID_HEIGHT];
+    uint32 chunk_versions[CHUNK_AMOUNT];
+    uint32 grid_version;
+    StateHash hash;
+    World world;
+    UndoLog undo;
     AStar a_star;
     Creature player;
     Creature creatures[CREATURE_CAPACITY];
+    Creature next_creatures[CREATURE_CAPACITY];
+    CreatureChunks chunks;
+    Schedule schedule;
+    ReservationLayer reservations[RESERVATION_LAYERS];
+    CooperativePath paths[CREATURE_CAPACITY];
+    SpaceTimeSearch space_time;
+    int active_count;
+    ActiveCreature active[CREATURE_CAPACITY];
+    // while resolving, one plus the active slot that claimed a target cell,
+    // 0 everywhere in between
+    int claims[GRID_WIDTH][GRID_HEIGHT];
+    int blocked_stack[CREATURE_CAPACITY];
+    uint32 turn;
+    Workers workers;
+    Recording recording;
+    Autosave autosave;
+    LevelGenerator generator;
+    LevelCache levels;
+    SimThread sim;
+    TileLayer tiles;
+    SpriteAtlas sprites;
+    MapOverview overview;
+    FrameCache frame;
     float game_timer;
     float turn_time;
     float animation_timer;
     float key_repeat_timer;
 } State;
 
-Cell screen_to_game_position(State *state, Vector2 screen_position) {
+Cell screen_to_game_position(Cell game_offset, Vector2 screen_position) {
     Cell game_position = {
-        .x = (screen_position.x / CELLSIZE) + state->game_offset.x,
-        .y = (screen_position.y / CELLSIZE) + state->game_offset.y,
+        .x = (screen_position.x / CELLSIZE) + game_offset.x,
+        .y = (screen_position.y / CELLSIZE) + game_offset.y,
     };
 
     if (game_position.x < 0) {
@@ -177,19 +728,162 @@ Cell screen_to_game_position(State *state, Vector2 screen_position) {
     return game_position;
 }
 
-Cell get_cell_local_position(State *state, Cell local_position) {
+Cell get_cell_local_position(FrameSnapshot *snapshot, Cell local_position) {
     return (Cell) {
-        local_position.x - state->game_offset.x,
-        local_position.y - state->game_offset.y,
+        local_position.x - snapshot->game_offset.x,
+        local_position.y - snapshot->game_offset.y,
     };
 }
 
-Cell astar_path(State *state, Cell start, Cell goal, int walkable_flags);
+// drawing backend, backend_raylib.c draws to the window and backend_software.c
+// rasterizes into memory for headless runs. exactly one of them is compiled in
+int gfx_screen_width(void);
+int gfx_screen_height(void);
+void gfx_begin_scene(void);
+void gfx_end_scene(void);
+void gfx_begin_present(void);
+void gfx_end_present(void);
+void gfx_unload_scene(void);
+void gfx_clear(Color color);
+void gfx_rect(Rectangle rec, Color color);
+int gfx_load_image(int width, int height, Color color);
+void gfx_update_image(int image, Rectangle region, const Color *pixels);
+void gfx_draw_image(int image, Rectangle source, Rectangle dest);
+void gfx_draw_image_batch(int image, const Rectangle *sources, const Rectangle *dests, int count);
+void gfx_unload_image(int image);
+void gfx_text(const char *text, int x, int y, int size, Color color);
+
+// scoped timing zones, compiled in with -DPROFILE. a zone adds the time from
+// PROFILE_BEGIN to PROFILE_END to its total for the frame, from any thread.
+// without PROFILE both expand to nothing
+#if PROFILE
+typedef enum ProfileZone {
+    PROFILE_ZONE_FRAME,
+    PROFILE_ZONE_RENDER,
+    PROFILE_ZONE_SNAPSHOT,
+    PROFILE_ZONE_TURN,
+    PROFILE_ZONE_CREATURES,
+    PROFILE_ZONE_VISION,
+    PROFILE_ZONE_ASTAR,
+    PROFILE_ZONE_COUNT,
+} ProfileZone;
+
+// over the frames in the ring, in milliseconds except calls per frame
+typedef struct ProfileStats {
+    float min;
+    float avg;
+    float p99;
+    float max;
+    float calls;
+} ProfileStats;
+
+// per search, bucket b of a histogram counts the values from 2^(b - 1) up to
+// 2^b, bucket 0 the zeros and the last one everything above
+typedef enum AStarMetric {
+    ASTAR_METRIC_EXPANDED,
+    ASTAR_METRIC_PEAK_OPEN,
+    ASTAR_METRIC_PATH_LENGTH,
+    ASTAR_METRIC_TIME_US,
+    ASTAR_METRIC_COUNT,
+} AStarMetric;
+
+double profile_begin(void);
+void profile_end(ProfileZone zone, double start);
+void record_astar_search(AStar *a, AStarSite site, Cell start, Cell goal, double ms);
+#define PROFILE_BEGIN(zone) double profile_start_##zone = profile_begin()
+#define PROFILE_END(zone) profile_end(PROFILE_ZONE_##zone, profile_start_##zone)
+#else
+#define PROFILE_BEGIN(zone)
+#define PROFILE_END(zone)
+#endif
+
+// timeline events for a trace viewer, compiled in with -DTRACE and recorded
+// only between trace_start and trace_stop. names must be string literals, the
+// buffer keeps the pointers. without TRACE the macros expand to nothing
+#if TRACE
+typedef struct TraceEvent {
+    const char *name;
+    const char *arg_name;
+    double time_us;
+    int arg;
+    uint16 thread;
+    char phase;
+} TraceEvent;
+
+void trace_event(const char *name, char phase, const char *arg_name, int arg);
+void trace_thread(const char *name);
+#define TRACE_BEGIN(name) trace_event(name, 'B', 0, 0)
+#define TRACE_BEGIN_ARG(name, arg_name, arg) trace_event(name, 'B', arg_name, arg)
+#define TRACE_END(name) trace_event(name, 'E', 0, 0)
+#define TRACE_THREAD(name) trace_thread(name)
+#else
+#define TRACE_BEGIN(name)
+#define TRACE_BEGIN_ARG(name, arg_name, arg)
+#define TRACE_END(name)
+#define TRACE_THREAD(name)
+#endif
+
+// counts of the work the hot paths do, compiled in with -DCOUNTERS. unlike
+// timings they only change when the algorithms do, on any machine. without
+// COUNTERS the macro expands to nothing
+#if COUNTERS
+typedef enum WorkCounter {
+    WORK_COUNTER_ASTAR_EXPANSIONS,
+    WORK_COUNTER_BFS_CELLS,
+    WORK_COUNTER_FOV_CELLS,
+    WORK_COUNTER_CELL_VALID,
+    WORK_COUNTER_MAPGEN_PROBES,
+    WORK_COUNTER_DRAW_CALLS,
+    WORK_COUNTER_COUNT,
+} WorkCounter;
+
+void count_work(WorkCounter counter, int amount);
+#define COUNT_WORK(counter, amount) count_work(WORK_COUNTER_##counter, amount)
+#else
+#define COUNT_WORK(counter, amount)
+#endif
+
+double get_time_ms(void);
+Cell astar_search(State *state, AStar *a, Cell start, Cell goal, int walkable_flags, AStarSite site);
+void save_creature_for_undo(State *state, int slot);
+Cell astar_path(State *state, Cell start, Cell goal, int walkable_flags, AStarSite site);
+void clear_level_cache(State *state);
+void run_turn(State *state, SimCommand *command);
 
 static inline bool has_flag(int flags, int flag) {
     return (flags & flag) == flag;
 }
 
+static inline uint32 random_next(uint32 *random) {
+    uint32 x = *random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *random = x;
+    return x;
+}
+
+static inline int random_range(uint32 *random, int min, int max) {
+    if (max < min) {
+        int tmp = max;
+        max = min;
+        min = tmp;
+    }
+    return min + (int)(random_next(random) % (uint32)(max - min + 1));
+}
+
+static inline Color get_cell_color(int cell) {
+    bool visible = has_flag(cell, CELL_FLAG_VISIBLE);
+    bool wall = has_flag(cell, CELL_FLAG_WALL);
+    if (cell & (CELL_FLAG_STAIRS | CELL_FLAG_STAIRS_UP)) {
+        return visible ? COLOR_STAIRS_VISIBLE : COLOR_STAIRS_INVISIBLE;
+    }
+    if (visible) {
+        return wall ? COLOR_WALL_VISIBLE : COLOR_GROUND_VISIBLE;
+    }
+    return wall ? COLOR_WALL_INVISIBLE : COLOR_GROUND_INVISIBLE;
+}
+
 static inline int manhattan_distance(Cell a, Cell b) {
     return abs(a.x - b.x) + abs(a.y - b.y);
 }
@@ -202,12 +896,112 @@ static inline bool is_cell_out_of_bounds(State *state, Cell cell) {
 }
 
 static inline bool is_cell_valid(State *state, Cell cell, int cell_flags) {
+    COUNT_WORK(CELL_VALID, 1);
     return (
         !is_cell_out_of_bounds(state, cell) &&
         (state->grid[cell.x][cell.y] & cell_flags) == cell_flags
     );
 }
 
+static inline int get_chunk(Cell cell) {
+    return (cell.x / CHUNK_SIZE) + ((cell.y / CHUNK_SIZE) * CHUNK_COLUMNS);
+}
+
+// chunk rectangle [min, max) covering the viewport grown by margin cells
+static inline void get_viewport_chunks(State *state, int margin, Cell *min, Cell *max) {
+    int left = state->game_offset.x - margin;
+    int top = state->game_offset.y - margin;
+    int right = state->game_offset.x + GAME_WIDTH + margin;
+    int bottom = state->game_offset.y + GAME_HEIGHT + margin;
+    *min = (Cell) {
+        (left > 0) ? (left / CHUNK_SIZE) : 0,
+        (top > 0) ? (top / CHUNK_SIZE) : 0,
+    };
+    *max = (Cell) {
+        (right < GRID_WIDTH) ? ((right / CHUNK_SIZE) + 1) : CHUNK_COLUMNS,
+        (bottom < GRID_HEIGHT) ? ((bottom / CHUNK_SIZE) + 1) : CHUNK_ROWS,
+    };
+}
+
+// splitmix64 finalizer, turns any 64 bits into a well mixed key
+static inline uint64 hash_mix(uint64 x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static inline uint64 hash_pair(uint64 key, int a, int b) {
+    return hash_mix(key ^ (((uint64)(uint32)a << 32) | (uint32)b));
+}
+
+// an empty cell contributes nothing, so a cleared grid hashes to zero
+static inline uint64 cell_hash_key(Cell cell, int flags) {
+    if (flags == 0) {
+        return 0;
+    }
+    return hash_mix((((uint64)(cell.x + (cell.y * GRID_WIDTH))) << 8) | (uint8)flags);
+}
+
+static inline uint64 creature_hash_key(int slot, Creature *c) {
+    uint64 key = hash_pair(0x9e3779b97f4a7c15ull, slot, c->type);
+    key = hash_pair(key, c->flags, c->direction);
+    key = hash_pair(key, c->position.x, c->position.y);
+    key = hash_pair(key, c->previous_position.x, c->previous_position.y);
+    key = hash_pair(key, c->last_known_player_location.x, c->last_known_player_location.y);
+    return hash_pair(key, c->random, 0);
+}
+
+// call after changing anything about a creature, slot is its index in
+// creatures or HASH_SLOT_PLAYER
+static inline void rehash_creature(State *state, int slot) {
+    Creature *c = (slot == HASH_SLOT_PLAYER) ? &state->player : &state->creatures[slot];
+    uint64 key = creature_hash_key(slot, c);
+    state->hash.creatures ^= state->hash.creature_keys[slot] ^ key;
+    state->hash.creature_keys[slot] = key;
+}
+
+// saves a cell's flags the first time the open turn changes it
+static inline void save_cell_for_undo(State *state, Cell cell, uint8 flags) {
+    UndoLog *u = &state->undo;
+    if (u->turn_count == 0 || u->restoring || u->cell_stamps[cell.x][cell.y] == u->turn_count) {
+        return;
+    }
+    u->cell_stamps[cell.x][cell.y] = u->turn_count;
+    u->cells[u->cell_count++ % UNDO_CELL_CAPACITY] = (UndoCell) { cell.x, cell.y, flags };
+}
+
+// every grid write after map generation goes through here so the chunk
+// versions tell consumers which parts of the grid changed
+static inline void write_cell(State *state, Cell cell, int flags) {
+    uint8 *grid_cell = &state->grid[cell.x][cell.y];
+    if (*grid_cell != flags) {
+        save_cell_for_undo(state, cell, *grid_cell);
+        state->hash.grid ^= cell_hash_key(cell, *grid_cell) ^ cell_hash_key(cell, flags);
+        *grid_cell = flags;
+        int chunk = get_chunk(cell);
+        state->chunk_versions[chunk]++;
+        state->world.dirty[chunk] = true;
+        state->grid_version++;
+    }
+}
+
+static inline void add_cell_flags(State *state, Cell cell, int flags) {
+    write_cell(state, cell, state->grid[cell.x][cell.y] | flags);
+}
+
+static inline void remove_cell_flags(State *state, Cell cell, int flags) {
+    write_cell(state, cell, state->grid[cell.x][cell.y] & ~flags);
+}
+
+static inline void touch_all_chunks(State *state) {
+    for (int i = 0; i < CHUNK_AMOUNT; i++) {
+        state->chunk_versions[i]++;
+    }
+    state->grid_version++;
+}
+
 Cell get_cell_in_direction(Cell position, uint8 direction, int amount) {
     switch (direction) {
     case ORTHAGONAL_N: return (Cell) { position.x, position.y - amount };
@@ -218,18 +1012,18 @@ Cell get_cell_in_direction(Cell position, uint8 direction, int amount) {
     }
 }
 
-Cell get_turn_offset(State *state, Creature *c) {
+Cell get_turn_offset(State *state, CreatureSnapshot *c) {
     return (Cell) {
         (((c->previous_position.x - c->position.x)) * (CELLSIZE - state->turn_time)),
         (((c->previous_position.y - c->position.y)) * (CELLSIZE - state->turn_time)),
     };
 }
 
-Cell get_turn_position(State *state, Creature *c) {
-    Cell player_turn_offset = get_turn_offset(state, &state->player);
+Cell get_turn_position(State *state, FrameSnapshot *snapshot, CreatureSnapshot *c) {
+    Cell player_turn_offset = get_turn_offset(state, &snapshot->player);
 
-    Cell current = get_cell_local_position(state, c->position);
-    Cell previous = get_cell_local_position(state, c->previous_position);
+    Cell current = get_cell_local_position(snapshot, c->position);
+    Cell previous = get_cell_local_position(snapshot, c->previous_position);
 
     return (Cell) {
         (previous.x * CELLSIZE) + ((current.x - previous.x) * state->turn_time) + HALF_CELLSIZE - player_turn_offset.x,
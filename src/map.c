@@ -1,6 +1,15 @@
 #include "main.h"
 
-static void dig_towards_target(State *state, Cell start, Cell goal, int walkable_flags, int width) {
+static inline bool is_generated_cell_valid(LevelGen *gen, Cell cell, int cell_flags) {
+    COUNT_WORK(MAPGEN_PROBES, 1);
+    return (
+        cell.x >= 0 && cell.x < GRID_WIDTH &&
+        cell.y >= 0 && cell.y < GRID_HEIGHT &&
+        (gen->grid[cell.x][cell.y] & cell_flags) == cell_flags
+    );
+}
+
+static void dig_towards_target(LevelGen *gen, Cell start, Cell goal, int walkable_flags, int width) {
     Cell cell = start;
     while (cell_neq(cell, goal)) {
         Cell options[3];
@@ -21,8 +30,8 @@ static void dig_towards_target(State *state, Cell start, Cell goal, int walkable
             options[1] = (Cell) { cell.x, cell.y + 1 };
             options[2] = (Cell) { cell.x + 1, cell.y };
         }
-        int option_idx = GetRandomValue(0, 2);
-        while (!is_cell_valid(state, options[option_idx], CELL_FLAG_ANY)) {
+        int option_idx = random_range(&gen->random, 0, 2);
+        while (!is_generated_cell_valid(gen, options[option_idx], CELL_FLAG_ANY)) {
             option_idx = (option_idx + 1) % 3;
         }
         cell = options[option_idx];
@@ -33,41 +42,41 @@ static void dig_towards_target(State *state, Cell start, Cell goal, int walkable
                     cell.x - half_width + x,
                     cell.y - half_width + y
                 };
-                if (is_cell_valid(state, surrounding_cell, CELL_FLAG_WALL)) {
-                    state->grid[surrounding_cell.x][surrounding_cell.y] = CELL_FLAG_WALKABLE;
+                if (is_generated_cell_valid(gen, surrounding_cell, CELL_FLAG_WALL)) {
+                    gen->grid[surrounding_cell.x][surrounding_cell.y] = CELL_FLAG_WALKABLE;
                 }
             }
         }
     }
 }
 
-static void dig_randomly(State *state, Cell start, int walkable_flags) {
+static void dig_randomly(LevelGen *gen, Cell start, int walkable_flags) {
     Cell cell = start;
-    state->grid[cell.x][cell.y] = CELL_FLAG_WALKABLE;
+    gen->grid[cell.x][cell.y] = CELL_FLAG_WALKABLE;
     for (int i = 0; i < 100; i++) {
-        if (GetRandomValue(0, 1) == 0) {
-            cell.x += GetRandomValue(-1, 1);
+        if (random_range(&gen->random, 0, 1) == 0) {
+            cell.x += random_range(&gen->random, -1, 1);
             if (cell.x < 0) {
                 cell.x = 0;
             } else if (cell.x >= GRID_WIDTH) {
                 cell.x = GRID_WIDTH - 1;
             }
         } else {
-            cell.y += GetRandomValue(-1, 1);
+            cell.y += random_range(&gen->random, -1, 1);
             if (cell.y < 0) {
                 cell.y = 0;
             } else if (cell.y >= GRID_HEIGHT) {
                 cell.y = GRID_HEIGHT - 1;
             }
         }
-        state->grid[cell.x][cell.y] = CELL_FLAG_WALKABLE;
+        gen->grid[cell.x][cell.y] = CELL_FLAG_WALKABLE;
     }
 }
 
-int random_direction(State *state, int current_direction) {
+int random_direction(LevelGen *gen, int current_direction) {
     int random_direction;
     do {
-        random_direction = GetRandomValue(0, 3);
+        random_direction = random_range(&gen->random, 0, 3);
     } while (random_direction == current_direction);
     return random_direction;
 }
@@ -114,7 +123,7 @@ int is_vertical(int direction) {
     return direction == ORTHAGONAL_N || direction == ORTHAGONAL_S;
 }
 
-int new_quadrant_disgusted_direction(Cell position, int direction) {
+int new_quadrant_disgusted_direction(LevelGen *gen, Cell position, int direction) {
     int horizontal_option = get_horizontal_direction_away_from_closest_edge(position.x);
     int vertical_option = get_vertical_direction_away_from_closest_edge(position.y);
     if (is_horizontal(direction)) {
@@ -123,13 +132,13 @@ int new_quadrant_disgusted_direction(Cell position, int direction) {
     if (is_vertical(direction)) {
         return horizontal_option;
     }
-    return (GetRandomValue(0, 1) == 0) ? horizontal_option : vertical_option;
+    return (random_range(&gen->random, 0, 1) == 0) ? horizontal_option : vertical_option;
 }
 
-int quadrant_disgusted_direction(Cell position) {
+int quadrant_disgusted_direction(LevelGen *gen, Cell position) {
     int horizontal_option = get_horizontal_direction_away_from_closest_edge(position.x);
     int vertical_option = get_vertical_direction_away_from_closest_edge(position.y);
-    return (GetRandomValue(0, 1) == 0) ? horizontal_option : vertical_option;
+    return (random_range(&gen->random, 0, 1) == 0) ? horizontal_option : vertical_option;
 }
 
 Room get_space_in_direction(Cell from, int direction, int length, int thickness) {
@@ -183,14 +192,14 @@ Room get_space_in_direction(Cell from, int direction, int length, int thickness)
     return room;
 }
 
-bool room_has_flags(State *state, Room *room, int flags) {
+bool room_has_flags(LevelGen *gen, Room *room, int flags) {
     for (int x = 0; x < room->size.x; x++) {
         for (int y = 0; y < room->size.y; y++) {
             Cell cell = {
                 room->position.x + x,
                 room->position.y + y
             };
-            if (has_flag(state->grid[cell.x][cell.y], flags)) {
+            if (has_flag(gen->grid[cell.x][cell.y], flags)) {
                 return true;
             }
         }
@@ -198,14 +207,14 @@ bool room_has_flags(State *state, Room *room, int flags) {
     return false;
 }
 
-bool is_space_available(State *state, Room *room, int flags) {
+bool is_space_available(LevelGen *gen, Room *room, int flags) {
     for (int x = 0; x < room->size.x; x++) {
         for (int y = 0; y < room->size.y; y++) {
             Cell cell = {
                 room->position.x + x,
                 room->position.y + y
             };
-            if (!is_cell_valid(state, cell, flags)) {
+            if (!is_generated_cell_valid(gen, cell, flags)) {
                 return false;
             }
         }
@@ -213,15 +222,15 @@ bool is_space_available(State *state, Room *room, int flags) {
     return true;
 }
 
-void room_set_flags(State *state, Room *room, int flags) {
+void room_set_flags(LevelGen *gen, Room *room, int flags) {
     for (int x = 0; x < room->size.x; x++) {
         for (int y = 0; y < room->size.y; y++) {
-            state->grid[room->position.x + x][room->position.y + y] = flags;
+            gen->grid[room->position.x + x][room->position.y + y] = flags;
         }
     }
 }
 
-void tunneler_dig(State *state, Tunneler *tunneler) {
+void tunneler_dig(LevelGen *gen, Tunneler *tunneler) {
     const int width_with_padding = tunneler->width + (tunneler->padding * 2);
 
     {
@@ -230,32 +239,32 @@ void tunneler_dig(State *state, Tunneler *tunneler) {
         bool valid;
         do {
             current_space = get_space_in_direction(current_position, tunneler->direction, 1, tunneler->width);
-            valid = is_space_available(state, &current_space, CELL_FLAG_ANY);
+            valid = is_space_available(gen, &current_space, CELL_FLAG_ANY);
             current_position = get_cell_in_direction(current_position, tunneler->direction, 1);
-        } while (valid && room_has_flags(state, &current_space, CELL_FLAG_WALKABLE));
+        } while (valid && room_has_flags(gen, &current_space, CELL_FLAG_WALKABLE));
         if (!valid) {
             return;
         }
 
         Room initial_required_space = get_space_in_direction(current_space.position, tunneler->direction, width_with_padding, width_with_padding);
-        if (!is_space_available(state, &initial_required_space, CELL_FLAG_ANY)) {
+        if (!is_space_available(gen, &initial_required_space, CELL_FLAG_ANY)) {
             return;
         }
     }
 
-    int r = GetRandomValue(tunneler->width * 5, tunneler->width * 20);
+    int r = random_range(&gen->random, tunneler->width * 5, tunneler->width * 20);
     for (int i = 0; i < r; i++) {
         Cell lookahead_cell = get_cell_in_direction(tunneler->position, tunneler->direction, 2);
         Room lookahead_room = get_space_in_direction(lookahead_cell, tunneler->direction, 1, width_with_padding);
 
-        if (!is_space_available(state, &lookahead_room, CELL_FLAG_WALL)) {
+        if (!is_space_available(gen, &lookahead_room, CELL_FLAG_WALL)) {
             return;
         }
 
         Cell next_cell = get_cell_in_direction(tunneler->position, tunneler->direction, 1);
         Room next_space = get_space_in_direction(next_cell, tunneler->direction, 1, tunneler->width);
 
-        room_set_flags(state, &next_space, CELL_FLAG_PLAYER_WALKABLE);
+        room_set_flags(gen, &next_space, CELL_FLAG_PLAYER_WALKABLE);
         tunneler->position = next_cell;
     }
 }
@@ -267,12 +276,12 @@ Cell room_center(Room *room) {
     };
 }
 
-int set_to_possible_direction(State *state, Tunneler *tunneler) {
+int set_to_possible_direction(LevelGen *gen, Tunneler *tunneler) {
     bool directions[4];
     bool some_found = false;
     for (int i = 0; i < 4; i++) {
         Room room = get_space_in_direction(tunneler->position, i, tunneler->width, tunneler->width);
-        directions[i] = (i != tunneler->direction) && is_space_available(state, &room, CELL_FLAG_WALL);
+        directions[i] = (i != tunneler->direction) && is_space_available(gen, &room, CELL_FLAG_WALL);
         if (directions[i]) {
             some_found = true;
         }
@@ -282,12 +291,12 @@ int set_to_possible_direction(State *state, Tunneler *tunneler) {
     }
     int direction;
     do {
-        direction = GetRandomValue(0,3);
+        direction = random_range(&gen->random, 0,3);
     } while (!directions[direction]);
     return direction;
 }
 
-void dig(State *state, Tunneler *tunneler) {
+void dig(LevelGen *gen, Tunneler *tunneler) {
     if (0) {
         Room room;
         room.position = tunneler->position;
@@ -295,9 +304,9 @@ void dig(State *state, Tunneler *tunneler) {
         bool valid;
         do {
             room = get_space_in_direction(room.position, tunneler->direction, tunneler->width, tunneler->width);
-            valid = is_space_available(state, &room, CELL_FLAG_ANY);
+            valid = is_space_available(gen, &room, CELL_FLAG_ANY);
             distance++;
-        } while (valid && room_has_flags(state, &room, CELL_FLAG_WALKABLE));
+        } while (valid && room_has_flags(gen, &room, CELL_FLAG_WALKABLE));
         if (!valid) {
             return;
         }
@@ -306,27 +315,27 @@ void dig(State *state, Tunneler *tunneler) {
     for (int i = 0; i < tunneler->lifetime; i++) {
         Room room = get_space_in_direction(tunneler->position, tunneler->direction, tunneler->width, tunneler->width);
         Room padded_room = get_space_in_direction(tunneler->position, tunneler->direction, (tunneler->width + tunneler->padding), tunneler->width + (tunneler->padding * 2));
-        if (!is_space_available(state, &padded_room, CELL_FLAG_ANY) ||
-            GetRandomValue(0, 100 - tunneler->chance_to_turn) == 0
+        if (!is_space_available(gen, &padded_room, CELL_FLAG_ANY) ||
+            random_range(&gen->random, 0, 100 - tunneler->chance_to_turn) == 0
         ) {
-            tunneler->direction = set_to_possible_direction(state, tunneler);
+            tunneler->direction = set_to_possible_direction(gen, tunneler);
             if (tunneler->direction < 0) {
                 return;
             }
             continue;
         }
-        room_set_flags(state, &room, CELL_FLAG_WALKABLE);
+        room_set_flags(gen, &room, CELL_FLAG_WALKABLE);
         tunneler->position = (Cell)room_center(&room);
     }
 }
 
-bool try_add_random_room(State *state, Room *room_result) {
+bool try_add_random_room(LevelGen *gen, Room *room_result) {
     const int min_room_size = 3;
     const int padding = 1;
 
     Cell position = {
-        GetRandomValue(1, GRID_WIDTH - 2 - min_room_size - padding),
-        GetRandomValue(1, GRID_HEIGHT - 2 - min_room_size - padding),
+        random_range(&gen->random, 1, GRID_WIDTH - 2 - min_room_size - padding),
+        random_range(&gen->random, 1, GRID_HEIGHT - 2 - min_room_size - padding),
     };
 
     const Cell largest_possible_room_size = {
@@ -337,10 +346,10 @@ bool try_add_random_room(State *state, Room *room_result) {
     const int max_room_size = 20;
 
     Cell size = {
-        GetRandomValue(min_room_size, largest_possible_room_size.x < max_room_size
+        random_range(&gen->random, min_room_size, largest_possible_room_size.x < max_room_size
             ? largest_possible_room_size.x
             : max_room_size),
-        GetRandomValue(min_room_size, largest_possible_room_size.y < max_room_size
+        random_range(&gen->random, min_room_size, largest_possible_room_size.y < max_room_size
             ? largest_possible_room_size.y
             : max_room_size),
     };
@@ -350,13 +359,13 @@ bool try_add_random_room(State *state, Room *room_result) {
         .size = { size.x + 2, size.y + 2, },
     };
 
-    if (!is_space_available(state, &padded_room, CELL_FLAG_WALL)) {
+    if (!is_space_available(gen, &padded_room, CELL_FLAG_WALL)) {
         return false;
     }
 
     for (int x = 0; x < size.x; x++) {
         for (int y = 0; y < size.y; y++) {
-            state->grid[position.x + x][position.y + y] = CELL_FLAG_WALKABLE;
+            gen->grid[position.x + x][position.y + y] = CELL_FLAG_WALKABLE;
         }
     }
 
@@ -366,10 +375,10 @@ bool try_add_random_room(State *state, Room *room_result) {
     return true;
 }
 
-void gen_map(State *state) {
+void gen_map(LevelGen *gen) {
     for (int x = 0; x < GRID_WIDTH; x++) {
         for (int y = 0; y < GRID_HEIGHT; y++) {
-            state->grid[x][y] = CELL_FLAG_WALL;
+            gen->grid[x][y] = CELL_FLAG_WALL;
         }
     }
 
@@ -380,7 +389,7 @@ void gen_map(State *state) {
 
     {
         for (int i = 0; i < room_capacity; i++) {
-            if (try_add_random_room(state, &mapgen->rooms[room_count])) {
+            if (try_add_random_room(gen, &mapgen->rooms[room_count])) {
                 room_count++;
             }
         }
@@ -388,20 +397,20 @@ void gen_map(State *state) {
 
     Tunneler tunneler;
     tunneler.lifetime = 1000;
-    tunneler.position = room_center(&mapgen->rooms[GetRandomValue(0, room_count)]);
-    tunneler.direction = quadrant_disgusted_direction(tunneler.position);
+    tunneler.position = room_center(&mapgen->rooms[random_range(&gen->random, 0, room_count)]);
+    tunneler.direction = quadrant_disgusted_direction(gen, tunneler.position);
     tunneler.width = 3;
     tunneler.padding = 1;
     tunneler.chance_to_turn = 10;
-    dig(state, &tunneler);
+    dig(gen, &tunneler);
 
     free(mapgen);
 }
 
-void generate_map(State *state) {
+void generate_map(LevelGen *gen) {
     for (int x = 0; x < GRID_WIDTH; x++) {
         for (int y = 0; y < GRID_HEIGHT; y++) {
-            state->grid[x][y] = CELL_FLAG_WALL;
+            gen->grid[x][y] = CELL_FLAG_WALL;
         }
     }
 
@@ -409,7 +418,7 @@ void generate_map(State *state) {
         Cell center = { (GRID_WIDTH / 2), (GRID_HEIGHT / 2) };
         for (int x = center.x - 2; x < center.x + 2; x++) {
             for (int y = center.y - 2; y < center.y + 2; y++) {
-                state->grid[x][y] = CELL_FLAG_WALKABLE;
+                gen->grid[x][y] = CELL_FLAG_WALKABLE;
             }
         }
     }
@@ -419,23 +428,23 @@ void generate_map(State *state) {
         for (int y = 0; y < pivot_box_size; y++) {
             int x2 = GRID_WIDTH - pivot_box_size + x;
             int y2 = GRID_HEIGHT - pivot_box_size + y;
-            state->grid[x][y] = CELL_FLAG_WALKABLE;
-            state->grid[x2][y] = CELL_FLAG_WALKABLE;
-            state->grid[x][y2] = CELL_FLAG_WALKABLE;
-            state->grid[x2][y2] = CELL_FLAG_WALKABLE;
+            gen->grid[x][y] = CELL_FLAG_WALKABLE;
+            gen->grid[x2][y] = CELL_FLAG_WALKABLE;
+            gen->grid[x][y2] = CELL_FLAG_WALKABLE;
+            gen->grid[x2][y2] = CELL_FLAG_WALKABLE;
         }
     }
 
     const int pivot_amount = 10;
     Cell pivots[pivot_amount];
-    Cell random_range = {
+    Cell pivot_margin = {
         GRID_WIDTH / 4,
         GRID_HEIGHT / 4,
     };
     for (int i = 0; i < pivot_amount; i++) {
         pivots[i] = (Cell) {
-            GetRandomValue(random_range.x, (GRID_WIDTH - 1) - random_range.x),
-            GetRandomValue(random_range.y, (GRID_HEIGHT - 1) - random_range.y)
+            random_range(&gen->random, pivot_margin.x, (GRID_WIDTH - 1) - pivot_margin.x),
+            random_range(&gen->random, pivot_margin.y, (GRID_HEIGHT - 1) - pivot_margin.y)
         };
     }
 
@@ -443,7 +452,7 @@ void generate_map(State *state) {
     {
         int used_pivots_flags = 0;
         for (int i = 0; i < pivot_amount; i++) {
-            int random_idx = GetRandomValue(0, pivot_amount - 1);
+            int random_idx = random_range(&gen->random, 0, pivot_amount - 1);
             int pivot_flag;
 
             do {
@@ -453,27 +462,26 @@ void generate_map(State *state) {
 
             used_pivots_flags |= pivot_flag;
             random_indices[i] = random_idx;
-            printf("%i\n", random_idx);
         }
     }
 
-    state->player.previous_position = pivots[random_indices[0]];
-    state->player.position = pivots[random_indices[0]];
+    gen->player.previous_position = pivots[random_indices[0]];
+    gen->player.position = pivots[random_indices[0]];
 
     for (int i = 1; i < pivot_amount + 1; i++) {
         int start_idx = random_indices[i % pivot_amount];
         Cell start = pivots[start_idx];
 
-        dig_randomly(state, start, CELL_FLAG_ANY);
+        dig_randomly(gen, start, CELL_FLAG_ANY);
 
         int goal_idx = random_indices[(i + 1) % pivot_amount];
         Cell goal = pivots[goal_idx];
 
-        dig_towards_target(state, start, goal, CELL_FLAG_ANY, 3);
+        dig_towards_target(gen, start, goal, CELL_FLAG_ANY, 3);
 
         if (i < CREATURE_CAPACITY) {
-            state->creatures[i].previous_position = pivots[start_idx];
-            state->creatures[i].position = pivots[start_idx];
+            gen->creatures[i].previous_position = pivots[start_idx];
+            gen->creatures[i].position = pivots[start_idx];
         }
     }
 
@@ -485,18 +493,32 @@ void generate_map(State *state) {
         for (int i = 0; i < ROOM_CAPACITY; i++) {
             Room room;
             Cell center = room_center(&room);
-            if (try_add_random_room(state, &room)) {
+            if (try_add_random_room(gen, &room)) {
                 Cell closest_pivot = { INT32_MAX, INT32_MAX };
                 for (int i = 0; i < pivot_amount; i++) {
                     if (manhattan_distance(center, pivots[i])) {
                         closest_pivot = pivots[i];
                     }
                 }
-                dig_towards_target(state, center, closest_pivot, CELL_FLAG_ANY, 1);
+                dig_towards_target(gen, center, closest_pivot, CELL_FLAG_ANY, 1);
                 room_count++;
             }
         }
     }
 
     free(mapgen);
+
+    // the way down is at the pivot farthest from where the player starts
+    gen->stairs = gen->player.position;
+    for (int i = 0; i < pivot_amount; i++) {
+        if (manhattan_distance(pivots[i], gen->player.position) > manhattan_distance(gen->stairs, gen->player.position)) {
+            gen->stairs = pivots[i];
+        }
+    }
+    gen->grid[gen->stairs.x][gen->stairs.y] = CELL_FLAG_WALKABLE | CELL_FLAG_STAIRS;
+
+    // below the first level the player arrives on the way back up
+    if (gen->depth > 0 && cell_neq(gen->stairs, gen->player.position)) {
+        gen->grid[gen->player.position.x][gen->player.position.y] = CELL_FLAG_WALKABLE | CELL_FLAG_STAIRS_UP;
+    }
 }
@@ -1,12 +1,17 @@
 #include <math.h>
+#include <limits.h>
 #include "main.h"
 
-Cell astar_path(State *state, Cell start, Cell goal, int walkable_flags) {
+static Cell find_astar_step(State *state, AStar *a, Cell start, Cell goal, int walkable_flags) {
+    a->open_list_count = 0;
+    a->closed_list_count = 0;
+    a->peak_open_count = 0;
+    a->path_length = -1;
     if (cell_eq(start, goal)) {
+        a->path_length = 0;
         return start;
     }
 
-    AStar *a = &state->a_star;
     for (int x = 0; x < GRID_WIDTH; x++) {
         for (int y = 0; y < GRID_HEIGHT; y++) {
             a->all_list[x][y].position.x = x;
@@ -18,6 +23,7 @@ Cell astar_path(State *state, Cell start, Cell goal, int walkable_flags) {
     }
 
     a->open_list_count = 1;
+    a->peak_open_count = 1;
     a->open_list[0] = &(a->all_list[start.x][start.y]);
     a->open_list[0]->g_cost = 0;
     a->open_list[0]->f_cost = manhattan_distance(start, goal);
@@ -35,6 +41,7 @@ Cell astar_path(State *state, Cell start, Cell goal, int walkable_flags) {
         }
         ANode *current = a->open_list[current_idx];
         if (current->position.x == goal.x && current->position.y == goal.y) {
+            a->path_length = current->g_cost;
             while (cell_neq(current->came_from->position, start)) {
                 current = current->came_from;
             }
@@ -88,6 +95,9 @@ Cell astar_path(State *state, Cell start, Cell goal, int walkable_flags) {
                 }
                 a->open_list[a->open_list_count] = n;
                 a->open_list_count++;
+                if (a->open_list_count > a->peak_open_count) {
+                    a->peak_open_count = a->open_list_count;
+                }
             }
         }
     }
@@ -95,28 +105,95 @@ Cell astar_path(State *state, Cell start, Cell goal, int walkable_flags) {
     return start;
 }
 
-CoordAndDirection bounce_path(State *state, Cell start, uint8 direction) {
-    Cell n = {start.x, start.y - 1};
-    Cell w = {start.x - 1, start.y};
-    Cell s = {start.x, start.y + 1};
-    Cell e = {start.x + 1, start.y};
+// the first step from start towards goal, start when there is none. site
+// only tells the searches apart when built with PROFILE
+Cell astar_search(State *state, AStar *a, Cell start, Cell goal, int walkable_flags, AStarSite site) {
+    #if PROFILE
+    double start_ms = get_time_ms();
+    #endif
+    Cell step = find_astar_step(state, a, start, goal, walkable_flags);
+    COUNT_WORK(ASTAR_EXPANSIONS, a->closed_list_count);
+    #if PROFILE
+    record_astar_search(a, site, start, goal, get_time_ms() - start_ms);
+    #endif
+    return step;
+}
+
+Cell astar_path(State *state, Cell start, Cell goal, int walkable_flags, AStarSite site) {
+    PROFILE_BEGIN(ASTAR);
+    TRACE_BEGIN("astar");
+    Cell step = astar_search(state, &state->a_star, start, goal, walkable_flags, site);
+    TRACE_END("astar");
+    PROFILE_END(ASTAR);
+    return step;
+}
+
+Cell step_towards(State *state, Cell start, Cell goal, int walkable_flags) {
+    Cell delta = cell_subtract(goal, start);
+    Cell horizontal = { start.x + ((delta.x > 0) - (delta.x < 0)), start.y };
+    Cell vertical = { start.x, start.y + ((delta.y > 0) - (delta.y < 0)) };
+    bool horizontal_first = abs(delta.x) >= abs(delta.y);
+    Cell first = horizontal_first ? horizontal : vertical;
+    Cell second = horizontal_first ? vertical : horizontal;
+    if (cell_neq(first, start) && is_cell_valid(state, first, walkable_flags)) {
+        return first;
+    }
+    if (cell_neq(second, start) && is_cell_valid(state, second, walkable_flags)) {
+        return second;
+    }
+    return start;
+}
+
+static const Cell neighbour_offsets[8] = {
+    [NEIGHBOUR_N] = { 0, -1 },
+    [NEIGHBOUR_W] = { -1, 0 },
+    [NEIGHBOUR_S] = { 0, 1 },
+    [NEIGHBOUR_E] = { 1, 0 },
+    [NEIGHBOUR_NE] = { 1, -1 },
+    [NEIGHBOUR_NW] = { -1, -1 },
+    [NEIGHBOUR_SW] = { -1, 1 },
+    [NEIGHBOUR_SE] = { 1, 1 },
+};
+
+// bounce_table[mask][direction] is the diagonal to move along next, or
+// NO_DIRECTION when the creature is stuck and keeps its direction
+static uint8 bounce_table[256][4];
+// wander_table[(mask & 15) << 4 | backtrack << 2 | random] is the direction to
+// step in, or NO_DIRECTION when the creature has nowhere to go
+static uint8 wander_table[256];
+
+// rebuilds the masks of the cells in [min, max)
+void build_neighbour_masks_in(State *state, Cell min, Cell max) {
+    for (int x = min.x; x < max.x; x++) {
+        for (int y = min.y; y < max.y; y++) {
+            uint8 mask = 0;
+            for (int i = 0; i < 8; i++) {
+                Cell n = cell_add((Cell) { x, y }, neighbour_offsets[i]);
+                if (is_cell_valid(state, n, CELL_FLAG_WALKABLE)) {
+                    mask |= (1 << i);
+                }
+            }
+            state->neighbours[x][y] = mask;
+        }
+    }
+}
 
-    bool n_wall = !is_cell_valid(state, n, CELL_FLAG_WALKABLE);
-    bool w_wall = !is_cell_valid(state, w, CELL_FLAG_WALKABLE);
-    bool s_wall = !is_cell_valid(state, s, CELL_FLAG_WALKABLE);
-    bool e_wall = !is_cell_valid(state, e, CELL_FLAG_WALKABLE);
+void build_neighbour_masks(State *state) {
+    build_neighbour_masks_in(state, (Cell) { 0, 0 }, (Cell) { GRID_WIDTH, GRID_HEIGHT });
+}
 
-    Cell ne = {start.x + 1, start.y - 1};
-    Cell nw = {start.x - 1, start.y - 1};
-    Cell sw = {start.x - 1, start.y + 1};
-    Cell se = {start.x + 1, start.y + 1};
+static int bounce_direction(uint8 mask, uint8 direction) {
+    bool n_wall = !has_flag(mask, 1 << NEIGHBOUR_N);
+    bool w_wall = !has_flag(mask, 1 << NEIGHBOUR_W);
+    bool s_wall = !has_flag(mask, 1 << NEIGHBOUR_S);
+    bool e_wall = !has_flag(mask, 1 << NEIGHBOUR_E);
 
-    bool ne_open = is_cell_valid(state, ne, CELL_FLAG_WALKABLE);
-    bool nw_open = is_cell_valid(state, nw, CELL_FLAG_WALKABLE);
-    bool sw_open = is_cell_valid(state, sw, CELL_FLAG_WALKABLE);
-    bool se_open = is_cell_valid(state, se, CELL_FLAG_WALKABLE);
+    bool ne_open = has_flag(mask, 1 << NEIGHBOUR_NE);
+    bool nw_open = has_flag(mask, 1 << NEIGHBOUR_NW);
+    bool sw_open = has_flag(mask, 1 << NEIGHBOUR_SW);
+    bool se_open = has_flag(mask, 1 << NEIGHBOUR_SE);
 
-    int bounce = -1;
+    int bounce = NO_DIRECTION;
 
     switch (direction) {
         case DIAGONAL_NE:
@@ -158,42 +235,74 @@ CoordAndDirection bounce_path(State *state, Cell start, uint8 direction) {
             else if (!s_wall && se_open) bounce = DIAGONAL_SE;
             else bounce = DIAGONAL_NW;
             break;
-
-        default:
-            return (CoordAndDirection) { start, 0 };
     }
 
-    switch (bounce) {
-        case DIAGONAL_NE: return (CoordAndDirection){ne, DIAGONAL_NE};
-        case DIAGONAL_NW: return (CoordAndDirection){nw, DIAGONAL_NW};
-        case DIAGONAL_SE: return (CoordAndDirection){se, DIAGONAL_SE};
-        case DIAGONAL_SW: return (CoordAndDirection){sw, DIAGONAL_SW};
+    return bounce;
+}
+
+static int wander_direction(uint8 mask, int backtrack, int random) {
+    for (int i = 0; i < 4; i++) {
+        int direction = (random + i) % 4;
+        if (has_flag(mask, 1 << direction) && direction != backtrack) {
+            return direction;
+        }
     }
+    if (has_flag(mask, 1 << backtrack)) {
+        return backtrack;
+    }
+    return NO_DIRECTION;
+}
 
-    return (CoordAndDirection) { start, direction };
+void init_movement_tables(void) {
+    for (int mask = 0; mask < 256; mask++) {
+        for (int direction = 0; direction < 4; direction++) {
+            bounce_table[mask][direction] = bounce_direction(mask, direction);
+        }
+        wander_table[mask] = wander_direction(mask >> 4, (mask >> 2) & 3, mask & 3);
+    }
 }
 
-Cell random_wander(State *state, Cell start, uint8 direction) {
-    int random = GetRandomValue(0, 3);
-    Cell backtrack_cell = get_cell_in_direction(start, (direction + 2) % 4, 1);
-    for (int i = 0; i < 4; i++) {
-        Cell position;
-        switch (random) {
-        case 0: position = (Cell) {start.x, start.y - 1}; break;
-        case 1: position = (Cell) {start.x - 1, start.y}; break;
-        case 2: position = (Cell) {start.x, start.y + 1}; break;
-        case 3: position = (Cell) {start.x + 1, start.y}; break;
+// moves every creature in the batch one bounce, positions and directions are
+// updated in place and each creature costs one mask read and one table read
+void bounce_batch(State *state, Cell *positions, uint16 *directions, int count) {
+    for (int i = 0; i < count; i++) {
+        uint8 mask = state->neighbours[positions[i].x][positions[i].y];
+        uint8 direction = directions[i];
+        if (direction > DIAGONAL_SE) {
+            directions[i] = 0;
+            continue;
         }
-        bool valid = is_cell_valid(state, position, CELL_FLAG_WALKABLE);
-        bool backtrack = cell_eq(backtrack_cell, position);
-        if (valid && !backtrack) {
-            return position;
+        uint8 bounce = bounce_table[mask][direction];
+        if (bounce == NO_DIRECTION) {
+            continue;
         }
-        random = (random + 1) % 4;
+        positions[i] = cell_add(positions[i], neighbour_offsets[NEIGHBOUR_NE + bounce]);
+        directions[i] = bounce;
     }
-    bool okay_backtrack_if_that_is_the_only_way = is_cell_valid(state, backtrack_cell, CELL_FLAG_WALKABLE);
-    if (okay_backtrack_if_that_is_the_only_way) {
-        return backtrack_cell;
+}
+
+void wander_batch(State *state, Cell *positions, uint16 *directions, uint32 *randoms, int count) {
+    for (int i = 0; i < count; i++) {
+        uint8 mask = state->neighbours[positions[i].x][positions[i].y];
+        int backtrack = (directions[i] + 2) % 4;
+        int random = random_range(&randoms[i], 0, 3);
+        uint8 direction = wander_table[((mask & 15) << 4) | (backtrack << 2) | random];
+        if (direction != NO_DIRECTION) {
+            positions[i] = cell_add(positions[i], neighbour_offsets[direction]);
+        }
     }
-    return start;
+}
+
+CoordAndDirection bounce_path(State *state, Cell start, uint8 direction) {
+    Cell position = start;
+    uint16 new_direction = direction;
+    bounce_batch(state, &position, &new_direction, 1);
+    return (CoordAndDirection) { position, new_direction };
+}
+
+Cell random_wander(State *state, Cell start, uint8 direction, uint32 *seed) {
+    Cell position = start;
+    uint16 wander_from = direction;
+    wander_batch(state, &position, &wander_from, seed, 1);
+    return position;
 }
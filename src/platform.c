@@ -0,0 +1,128 @@
+#include "main.h"
+
+// the few operating system calls the game needs beyond the c library. the
+// game itself builds on windows, the headless and terminal frontends on posix
+
+#if defined(_WIN32)
+
+// keep windows.h from declaring names that raylib.h already uses
+#define NOGDI
+#define NOUSER
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+
+bool map_file(MappedFile *m, const char *path) {
+    *m = (MappedFile) { 0 };
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = 0;
+    void *data = 0;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        mapping = CreateFileMappingA(file, 0, PAGE_READWRITE, 0, 0, 0);
+    }
+    if (mapping) {
+        data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    }
+    if (!data) {
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+    m->data = (uint8 *)data;
+    m->size = (size_t)size.QuadPart;
+    m->file = file;
+    m->mapping = mapping;
+    return true;
+}
+
+void unmap_file(MappedFile *m) {
+    if (!m->data) {
+        return;
+    }
+    FlushViewOfFile(m->data, 0);
+    UnmapViewOfFile(m->data);
+    CloseHandle((HANDLE)m->mapping);
+    CloseHandle((HANDLE)m->file);
+    *m = (MappedFile) { 0 };
+}
+
+// waits until what was written to file is on the disk, not just handed to
+// the system, so a replace that follows cannot leave an empty file behind
+bool sync_file(FILE *file) {
+    return fflush(file) == 0 && FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(file)));
+}
+
+// moves from over to in one step, readers see either the old file or the new
+bool replace_file(const char *from, const char *to) {
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+
+// milliseconds from an arbitrary start, unaffected by other threads and by
+// changes to the wall clock
+double get_time_ms(void) {
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return ((double)counter.QuadPart * 1000.0) / (double)frequency.QuadPart;
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+bool map_file(MappedFile *m, const char *path) {
+    *m = (MappedFile) { 0 };
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        data = mmap(0, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    m->data = (uint8 *)data;
+    m->size = info.st_size;
+    m->fd = fd;
+    return true;
+}
+
+void unmap_file(MappedFile *m) {
+    if (!m->data) {
+        return;
+    }
+    msync(m->data, m->size, MS_SYNC);
+    munmap(m->data, m->size);
+    close(m->fd);
+    *m = (MappedFile) { 0 };
+}
+
+bool sync_file(FILE *file) {
+    return fflush(file) == 0 && fsync(fileno(file)) == 0;
+}
+
+bool replace_file(const char *from, const char *to) {
+    return rename(from, to) == 0;
+}
+
+double get_time_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000.0) + (now.tv_nsec / 1000000.0);
+}
+
+#endif
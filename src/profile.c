@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+
+// zone times add up in pending from whichever thread runs them, the main
+// thread moves them into the ring once per frame. built only with -DPROFILE
+
+#if PROFILE
+
+static struct {
+    uint64 pending_ns[PROFILE_ZONE_COUNT];
+    uint32 pending_calls[PROFILE_ZONE_COUNT];
+    double last_frame;
+    int frame_count;
+    float ms[PROFILE_FRAMES][PROFILE_ZONE_COUNT];
+    uint16 calls[PROFILE_FRAMES][PROFILE_ZONE_COUNT];
+    bool overlay;
+} profiler;
+
+static const char *profile_zone_names[PROFILE_ZONE_COUNT] = {
+    [PROFILE_ZONE_FRAME] = "frame",
+    [PROFILE_ZONE_RENDER] = "render",
+    [PROFILE_ZONE_SNAPSHOT] = "snapshot",
+    [PROFILE_ZONE_TURN] = "turn",
+    [PROFILE_ZONE_CREATURES] = "creatures",
+    [PROFILE_ZONE_VISION] = "vision",
+    [PROFILE_ZONE_ASTAR] = "astar",
+};
+
+const char *get_profile_zone_name(ProfileZone zone) {
+    return profile_zone_names[zone];
+}
+
+double profile_begin(void) {
+    return get_time_ms();
+}
+
+void profile_end(ProfileZone zone, double start) {
+    uint64 ns = (uint64)((get_time_ms() - start) * 1000000.0);
+    __atomic_fetch_add(&profiler.pending_ns[zone], ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profiler.pending_calls[zone], 1, __ATOMIC_RELAXED);
+}
+
+// closes a frame, called once at the top of every main loop iteration. the
+// frame zone is the whole time since the previous call
+void profile_frame(void) {
+    double now = get_time_ms();
+    int slot = profiler.frame_count % PROFILE_FRAMES;
+    for (int zone = 0; zone < PROFILE_ZONE_COUNT; zone++) {
+        uint64 ns = __atomic_exchange_n(&profiler.pending_ns[zone], 0, __ATOMIC_RELAXED);
+        uint32 calls = __atomic_exchange_n(&profiler.pending_calls[zone], 0, __ATOMIC_RELAXED);
+        profiler.ms[slot][zone] = ns / 1000000.0f;
+        profiler.calls[slot][zone] = (calls < UINT16_MAX) ? calls : UINT16_MAX;
+    }
+    if (profiler.last_frame > 0.0) {
+        profiler.ms[slot][PROFILE_ZONE_FRAME] = now - profiler.last_frame;
+        profiler.calls[slot][PROFILE_ZONE_FRAME] = 1;
+        profiler.frame_count++;
+    }
+    profiler.last_frame = now;
+}
+
+static inline int get_profile_frames(void) {
+    return (profiler.frame_count < PROFILE_FRAMES) ? profiler.frame_count : PROFILE_FRAMES;
+}
+
+static int compare_floats(const void *a, const void *b) {
+    float x = *(const float *)a;
+    float y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+ProfileStats get_profile_stats(ProfileZone zone) {
+    ProfileStats stats = { 0 };
+    int count = get_profile_frames();
+    if (count == 0) {
+        return stats;
+    }
+    float sorted[PROFILE_FRAMES];
+    float total = 0.0f;
+    int calls = 0;
+    for (int i = 0; i < count; i++) {
+        sorted[i] = profiler.ms[i][zone];
+        total += sorted[i];
+        calls += profiler.calls[i][zone];
+    }
+    qsort(sorted, count, sizeof(float), compare_floats);
+    stats.min = sorted[0];
+    stats.max = sorted[count - 1];
+    stats.p99 = sorted[((count - 1) * 99) / 100];
+    stats.avg = total / count;
+    stats.calls = (float)calls / count;
+    return stats;
+}
+
+void toggle_profile_overlay(void) {
+    profiler.overlay = !profiler.overlay;
+}
+
+bool is_profile_overlay_shown(void) {
+    return profiler.overlay;
+}
+
+void print_profile_stats(void) {
+    printf("%-9s %8s %8s %8s %8s %8s\n", "zone", "min ms", "avg ms", "p99 ms", "max ms", "calls");
+    for (int zone = 0; zone < PROFILE_ZONE_COUNT; zone++) {
+        ProfileStats stats = get_profile_stats(zone);
+        printf("%-9s %8.3f %8.3f %8.3f %8.3f %8.1f\n",
+            profile_zone_names[zone], stats.min, stats.avg, stats.p99, stats.max, stats.calls
+        );
+    }
+}
+
+// one row per frame in the ring, oldest first, with the time and the calls
+// of every zone
+bool write_profile_csv(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "frame");
+    for (int zone = 0; zone < PROFILE_ZONE_COUNT; zone++) {
+        fprintf(file, ",%s_ms,%s_calls", profile_zone_names[zone], profile_zone_names[zone]);
+    }
+    fprintf(file, "\n");
+    int count = get_profile_frames();
+    int first = profiler.frame_count - count;
+    for (int frame = first; frame < profiler.frame_count; frame++) {
+        int slot = frame % PROFILE_FRAMES;
+        fprintf(file, "%d", frame);
+        for (int zone = 0; zone < PROFILE_ZONE_COUNT; zone++) {
+            fprintf(file, ",%.4f,%d", profiler.ms[slot][zone], profiler.calls[slot][zone]);
+        }
+        fprintf(file, "\n");
+    }
+    return fclose(file) == 0;
+}
+
+// searches run on the simulation thread and on the workers. the histograms
+// are atomic counters, the heaviest search is copied under the mutex, which
+// only the searches that expand more than the one kept so far take
+static struct {
+    uint32 queries[ASTAR_SITE_COUNT];
+    uint32 unreachable[ASTAR_SITE_COUNT];
+    uint32 histograms[ASTAR_SITE_COUNT][ASTAR_METRIC_COUNT][ASTAR_HISTOGRAM_BUCKETS];
+    pthread_mutex_t mutex;
+    int heaviest_expanded;
+    AStarRecord heaviest;
+    Cell expanded[CELLAMOUNT];
+    bool heatmap;
+} astar_profiler = { .mutex = PTHREAD_MUTEX_INITIALIZER, .heaviest_expanded = -1 };
+
+static const char *astar_site_names[ASTAR_SITE_COUNT] = {
+    [ASTAR_SITE_CLICK] = "click",
+    [ASTAR_SITE_MOVE] = "move",
+    [ASTAR_SITE_PREVIEW] = "preview",
+    [ASTAR_SITE_CHASE] = "chase",
+};
+
+static const char *astar_metric_names[ASTAR_METRIC_COUNT] = {
+    [ASTAR_METRIC_EXPANDED] = "expanded",
+    [ASTAR_METRIC_PEAK_OPEN] = "peak_open",
+    [ASTAR_METRIC_PATH_LENGTH] = "path_length",
+    [ASTAR_METRIC_TIME_US] = "time_us",
+};
+
+static int get_histogram_bucket(int value) {
+    int bucket = 0;
+    while (value > 0 && bucket < ASTAR_HISTOGRAM_BUCKETS - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void add_astar_metric(AStarSite site, AStarMetric metric, int value) {
+    int bucket = get_histogram_bucket(value);
+    __atomic_fetch_add(&astar_profiler.histograms[site][metric][bucket], 1, __ATOMIC_RELAXED);
+}
+
+void record_astar_search(AStar *a, AStarSite site, Cell start, Cell goal, double ms) {
+    __atomic_fetch_add(&astar_profiler.queries[site], 1, __ATOMIC_RELAXED);
+    if (a->path_length < 0) {
+        __atomic_fetch_add(&astar_profiler.unreachable[site], 1, __ATOMIC_RELAXED);
+    }
+    add_astar_metric(site, ASTAR_METRIC_EXPANDED, a->closed_list_count);
+    add_astar_metric(site, ASTAR_METRIC_PEAK_OPEN, a->peak_open_count);
+    add_astar_metric(site, ASTAR_METRIC_PATH_LENGTH, (a->path_length > 0) ? a->path_length : 0);
+    add_astar_metric(site, ASTAR_METRIC_TIME_US, (int)(ms * 1000.0));
+
+    if (a->closed_list_count <= __atomic_load_n(&astar_profiler.heaviest_expanded, __ATOMIC_RELAXED)) {
+        return;
+    }
+    pthread_mutex_lock(&astar_profiler.mutex);
+    if (a->closed_list_count > astar_profiler.heaviest_expanded) {
+        astar_profiler.heaviest_expanded = a->closed_list_count;
+        astar_profiler.heaviest = (AStarRecord) {
+            .site = site,
+            .start = start,
+            .goal = goal,
+            .expanded = a->closed_list_count,
+            .peak_open = a->peak_open_count,
+            .path_length = a->path_length,
+            .ms = ms,
+        };
+        for (int i = 0; i < a->closed_list_count; i++) {
+            astar_profiler.expanded[i] = a->closed_list[i]->position;
+        }
+    }
+    pthread_mutex_unlock(&astar_profiler.mutex);
+}
+
+// puts the heaviest search since the previous capture into the snapshot, or
+// the one before when there was none. any search after replaces it
+void capture_astar_heatmap(State *state, FrameSnapshot *snapshot) {
+    memset(snapshot->astar_heat, 0, sizeof(snapshot->astar_heat));
+    pthread_mutex_lock(&astar_profiler.mutex);
+    snapshot->astar_search = astar_profiler.heaviest;
+    int count = astar_profiler.heaviest.expanded;
+    for (int i = 0; i < count; i++) {
+        Cell local = cell_subtract(astar_profiler.expanded[i], state->game_offset);
+        if (local.x >= 0 && local.x < GAME_WIDTH && local.y >= 0 && local.y < GAME_HEIGHT) {
+            snapshot->astar_heat[local.x + (local.y * GAME_WIDTH)] = 1 + ((i * 254) / count);
+        }
+    }
+    astar_profiler.heaviest_expanded = -1;
+    pthread_mutex_unlock(&astar_profiler.mutex);
+}
+
+const char *get_astar_site_name(AStarSite site) {
+    return astar_site_names[site];
+}
+
+void toggle_astar_heatmap(void) {
+    astar_profiler.heatmap = !astar_profiler.heatmap;
+}
+
+bool is_astar_heatmap_shown(void) {
+    return astar_profiler.heatmap;
+}
+
+// a line per site and metric with the count in every bucket
+void print_astar_stats(void) {
+    for (int site = 0; site < ASTAR_SITE_COUNT; site++) {
+        if (astar_profiler.queries[site] == 0) {
+            continue;
+        }
+        printf("astar %s: %u searches, %u unreachable\n",
+            astar_site_names[site], astar_profiler.queries[site], astar_profiler.unreachable[site]
+        );
+        for (int metric = 0; metric < ASTAR_METRIC_COUNT; metric++) {
+            printf("  %-11s", astar_metric_names[metric]);
+            for (int bucket = 0; bucket < ASTAR_HISTOGRAM_BUCKETS; bucket++) {
+                printf(" %u", astar_profiler.histograms[site][metric][bucket]);
+            }
+            printf("\n");
+        }
+    }
+}
+
+// one row per site, metric and bucket, the bucket holds values from low up
+// to but not including high, -1 for the last one
+bool write_astar_csv(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "site,metric,low,high,count\n");
+    for (int site = 0; site < ASTAR_SITE_COUNT; site++) {
+        for (int metric = 0; metric < ASTAR_METRIC_COUNT; metric++) {
+            for (int bucket = 0; bucket < ASTAR_HISTOGRAM_BUCKETS; bucket++) {
+                long low = (bucket == 0) ? 0 : 1L << (bucket - 1);
+                long high = (bucket == ASTAR_HISTOGRAM_BUCKETS - 1) ? -1 : 1L << bucket;
+                fprintf(file, "%s,%s,%ld,%ld,%u\n",
+                    astar_site_names[site], astar_metric_names[metric], low, high,
+                    astar_profiler.histograms[site][metric][bucket]
+                );
+            }
+        }
+    }
+    return fclose(file) == 0;
+}
+
+#endif
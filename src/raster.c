@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <math.h>
+#include "main.h"
+
+// cpu rasterization into a Canvas, used by the software backend for whole
+// frames and by both backends to pre-rasterize sprites
+
+static inline void blend_pixel(Color *dst, Color src) {
+    if (src.a == 255) {
+        *dst = src;
+        return;
+    }
+    int a = src.a;
+    int ia = 255 - a;
+    dst->r = ((src.r * a) + (dst->r * ia)) / 255;
+    dst->g = ((src.g * a) + (dst->g * ia)) / 255;
+    dst->b = ((src.b * a) + (dst->b * ia)) / 255;
+    dst->a = a + ((dst->a * ia) / 255);
+}
+
+// pixel centers inside [min, max) are covered, the same rule is used by every
+// primitive so shapes that share an edge never overlap or leave a gap
+static inline int first_pixel(float min) {
+    return (int)ceilf(min - 0.5f);
+}
+
+static void clip_span(Canvas *canvas, float min_x, float min_y, float max_x, float max_y, int *x0, int *y0, int *x1, int *y1) {
+    *x0 = first_pixel(min_x);
+    *y0 = first_pixel(min_y);
+    *x1 = first_pixel(max_x);
+    *y1 = first_pixel(max_y);
+    if (*x0 < 0) *x0 = 0;
+    if (*y0 < 0) *y0 = 0;
+    if (*x1 > canvas->width) *x1 = canvas->width;
+    if (*y1 > canvas->height) *y1 = canvas->height;
+}
+
+void raster_clear(Canvas *canvas, Color color) {
+    for (int i = 0; i < canvas->width * canvas->height; i++) {
+        canvas->pixels[i] = color;
+    }
+}
+
+Canvas load_canvas(int width, int height, Color color) {
+    Canvas canvas = {
+        .width = width,
+        .height = height,
+        .pixels = (Color *)malloc(width * height * sizeof(Color)),
+    };
+    raster_clear(&canvas, color);
+    return canvas;
+}
+
+void unload_canvas(Canvas *canvas) {
+    free(canvas->pixels);
+    *canvas = (Canvas) { 0 };
+}
+
+void raster_rect(Canvas *canvas, Rectangle rec, Color color) {
+    int x0, y0, x1, y1;
+    clip_span(canvas, rec.x, rec.y, rec.x + rec.width, rec.y + rec.height, &x0, &y0, &x1, &y1);
+    for (int y = y0; y < y1; y++) {
+        Color *row = &canvas->pixels[y * canvas->width];
+        for (int x = x0; x < x1; x++) {
+            blend_pixel(&row[x], color);
+        }
+    }
+}
+
+void raster_circle(Canvas *canvas, Vector2 center, float radius, Color color) {
+    int x0, y0, x1, y1;
+    clip_span(canvas, center.x - radius, center.y - radius, center.x + radius, center.y + radius, &x0, &y0, &x1, &y1);
+    float radius_sq = radius * radius;
+    for (int y = y0; y < y1; y++) {
+        Color *row = &canvas->pixels[y * canvas->width];
+        float dy = (y + 0.5f) - center.y;
+        for (int x = x0; x < x1; x++) {
+            float dx = (x + 0.5f) - center.x;
+            if ((dx * dx) + (dy * dy) < radius_sq) {
+                blend_pixel(&row[x], color);
+            }
+        }
+    }
+}
+
+static inline float edge_function(Vector2 a, Vector2 b, float x, float y) {
+    return ((b.x - a.x) * (y - a.y)) - ((b.y - a.y) * (x - a.x));
+}
+
+// accepts either winding, the edge signs are flipped for clockwise input
+void raster_triangle(Canvas *canvas, Vector2 a, Vector2 b, Vector2 c, Color color) {
+    float area = edge_function(a, b, c.x, c.y);
+    if (area == 0.0f) {
+        return;
+    }
+    float sign = (area > 0.0f) ? 1.0f : -1.0f;
+    float min_x = fminf(a.x, fminf(b.x, c.x));
+    float min_y = fminf(a.y, fminf(b.y, c.y));
+    float max_x = fmaxf(a.x, fmaxf(b.x, c.x));
+    float max_y = fmaxf(a.y, fmaxf(b.y, c.y));
+    int x0, y0, x1, y1;
+    clip_span(canvas, min_x, min_y, max_x, max_y, &x0, &y0, &x1, &y1);
+    for (int y = y0; y < y1; y++) {
+        Color *row = &canvas->pixels[y * canvas->width];
+        float py = y + 0.5f;
+        for (int x = x0; x < x1; x++) {
+            float px = x + 0.5f;
+            bool inside = (
+                edge_function(a, b, px, py) * sign >= 0.0f &&
+                edge_function(b, c, px, py) * sign >= 0.0f &&
+                edge_function(c, a, px, py) * sign >= 0.0f
+            );
+            if (inside) {
+                blend_pixel(&row[x], color);
+            }
+        }
+    }
+}
+
+// nearest neighbour, which is what the scaled tile and map textures use too
+void raster_canvas(Canvas *canvas, Canvas *src, Rectangle source, Rectangle dest) {
+    if (dest.width <= 0.0f || dest.height <= 0.0f) {
+        return;
+    }
+    int x0, y0, x1, y1;
+    clip_span(canvas, dest.x, dest.y, dest.x + dest.width, dest.y + dest.height, &x0, &y0, &x1, &y1);
+    float scale_x = source.width / dest.width;
+    float scale_y = source.height / dest.height;
+    for (int y = y0; y < y1; y++) {
+        int sy = source.y + (int)(((y + 0.5f) - dest.y) * scale_y);
+        if (sy < 0 || sy >= src->height) {
+            continue;
+        }
+        Color *row = &canvas->pixels[y * canvas->width];
+        Color *src_row = &src->pixels[sy * src->width];
+        for (int x = x0; x < x1; x++) {
+            int sx = source.x + (int)(((x + 0.5f) - dest.x) * scale_x);
+            if (sx >= 0 && sx < src->width) {
+                blend_pixel(&row[x], src_row[sx]);
+            }
+        }
+    }
+}
@@ -1,173 +1,347 @@
 #include "../raylib/include/raylib.h"
 #include "main.h"
 
-void draw_cell(State *state, Cell cell, Color color) {
-    Cell cell_local_position = get_cell_local_position(state, cell);
-    Cell player_turn_offset = get_turn_offset(state, &state->player);
+void draw_cell(State *state, FrameSnapshot *snapshot, Cell cell, Color color) {
+    Cell cell_local_position = get_cell_local_position(snapshot, cell);
+    Cell player_turn_offset = get_turn_offset(state, &snapshot->player);
     Rectangle rec = {
         .x = (cell_local_position.x * CELLSIZE) - player_turn_offset.x,
         .y = (cell_local_position.y * CELLSIZE) - player_turn_offset.y,
         .width = CELLSIZE,
         .height = CELLSIZE
     };
-    DrawRectangleRec(rec, color);
-}
-
-void draw_evil_triangle(State *state, Cell center, float size, Color color) {
-    const float d = (2.0f * PI) / 3.0f;
-    const float time = state->animation_timer / TIME_PER_ANIMATION;
-    Vector2 v[3];
-    for (int i = 0; i < 3; i++) {
-        float value = (d * i) + (time * d);
-        v[i] = (Vector2) {
-            .x = center.x + (sin(value) * HALF_CELLSIZE * size),
-            .y = center.y + (cos(value) * HALF_CELLSIZE * size),
+    gfx_rect(rec, color);
+}
+
+// the simulation fills the tile colours once per turn or scroll, every other
+// frame is a single blit
+void update_tile_layer(FrameSnapshot *snapshot, TileLayer *tiles) {
+    if (!tiles->loaded) {
+        tiles->image = gfx_load_image(GAME_WIDTH, GAME_HEIGHT, COLOR_UNDISCOVERED);
+        tiles->loaded = true;
+    } else if (tiles->turn == snapshot->turn && cell_eq(tiles->offset, snapshot->game_offset)) {
+        return;
+    }
+    tiles->turn = snapshot->turn;
+    tiles->offset = snapshot->game_offset;
+    gfx_update_image(tiles->image, (Rectangle) { 0, 0, GAME_WIDTH, GAME_HEIGHT }, snapshot->tiles);
+}
+
+void draw_tile_layer(State *state, FrameSnapshot *snapshot, TileLayer *tiles) {
+    Cell player_turn_offset = get_turn_offset(state, &snapshot->player);
+    Rectangle source = { 0, 0, GAME_WIDTH, GAME_HEIGHT };
+    Rectangle dest = {
+        .x = -player_turn_offset.x,
+        .y = -player_turn_offset.y,
+        .width = GAME_WIDTH * CELLSIZE,
+        .height = GAME_HEIGHT * CELLSIZE,
+    };
+    gfx_draw_image(tiles->image, source, dest);
+}
+
+static void add_creature_sprites(State *state, FrameSnapshot *snapshot, CreatureSnapshot *c, int frame, Rectangle *sources, Rectangle *dests, int *count) {
+    Cell body = get_turn_position(state, snapshot, c);
+    Rectangle dest = { body.x - (SPRITE_SIZE / 2), body.y - (SPRITE_SIZE / 2), SPRITE_SIZE, SPRITE_SIZE };
+    sources[*count] = get_body_sprite(c->type, frame);
+    dests[(*count)++] = dest;
+    if (c->type != CREATURE_DIGGER) {
+        sources[*count] = get_eye_sprite(c->type, c->direction);
+        dests[(*count)++] = dest;
+    }
+}
+
+// every creature is a body and an eye quad out of the sprite atlas, drawn in
+// one batch so the cost does not depend on what the creatures look like
+void draw_creatures(State *state, FrameSnapshot *snapshot) {
+    SpriteAtlas *atlas = &state->sprites;
+    if (!atlas->loaded) {
+        load_sprite_atlas(atlas);
+    }
+    static Rectangle sources[(CREATURE_CAPACITY + 1) * 2];
+    static Rectangle dests[(CREATURE_CAPACITY + 1) * 2];
+    int count = 0;
+    int frame = get_animation_frame(state->animation_timer);
+    add_creature_sprites(state, snapshot, &snapshot->player, frame, sources, dests, &count);
+    for (int i = 0; i < snapshot->creature_count; i++) {
+        add_creature_sprites(state, snapshot, &snapshot->creatures[i], frame, sources, dests, &count);
+    }
+    gfx_draw_image_batch(atlas->image, sources, dests, count);
+}
+
+static bool has_animated_creatures(FrameSnapshot *snapshot) {
+    for (int i = 0; i < snapshot->creature_count; i++) {
+        CreatureType type = snapshot->creatures[i].type;
+        if (type == CREATURE_EVIL_TRIANGLE || type == CREATURE_BIG_EVIL_TRIANGLE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static FrameKey get_frame_key(State *state, FrameSnapshot *snapshot, bool map_view) {
+    if (map_view) {
+        return (FrameKey) {
+            .map_view = true,
+            .version = snapshot->grid_version,
         };
     }
-    DrawTriangle(v[0], v[1], v[2], color);
-}
-
-void draw_creature(State *state, Creature *c) {
-    Cell body = get_turn_position(state, c);
-
-    int eye_radius;
-    bool diagonal_eye = false;
-    switch (c->type) {
-    case CREATURE_PLAYER: {
-        DrawCircle(body.x, body.y, HALF_CELLSIZE, COLOR_CREATURE_PLAYER);
-        eye_radius = 0.3f * CELLSIZE;
-    } break;
-    case CREATURE_DIGGER: {
-        Rectangle rec = { body.x, body.y, CELLSIZE, CELLSIZE };
-        Vector2 origin = { HALF_CELLSIZE, HALF_CELLSIZE };
-        DrawRectanglePro(rec, origin, 0.0f, GREEN);
-    } break;
-    case CREATURE_EVIL_TRIANGLE: {
-        draw_evil_triangle(state, body, 1.0f, COLOR_CREATURE_ENEMY);
-        eye_radius = 0.2f * CELLSIZE;
-        diagonal_eye = true;
-    } break;
-    case CREATURE_BIG_EVIL_TRIANGLE: {
-        draw_evil_triangle(state, body, 1.5f, COLOR_CREATURE_ENEMY2);
-        eye_radius = 0.3f * CELLSIZE;
-    } break;
-    }
-
-    DrawCircle(body.x, body.y, eye_radius, WHITE);
-
-    int pupil_radius = eye_radius * 0.4f;
-    Cell pupil = {0,0};
-    int off = eye_radius * 0.25f;
-    if (diagonal_eye) {
-        switch (c->direction) {
-        case DIAGONAL_NE: pupil.x = off; pupil.y = -off; break;
-        case DIAGONAL_NW: pupil.x = -off; pupil.y = -off; break;
-        case DIAGONAL_SW: pupil.x = -off; pupil.y = off; break;
-        case DIAGONAL_SE: pupil.x = off; pupil.y = off; break;
+    return (FrameKey) {
+        .version = snapshot->version,
+        .turn_time = state->turn_time,
+        .animation_frame = has_animated_creatures(snapshot) ? get_animation_frame(state->animation_timer) : 0,
+    };
+}
+
+static bool frame_key_eq(FrameKey a, FrameKey b) {
+    return (
+        a.map_view == b.map_view &&
+        a.version == b.version &&
+        a.turn_time == b.turn_time &&
+        a.animation_frame == b.animation_frame
+    );
+}
+
+// returns true when the cached frame is out of date and has to be redrawn,
+// in that case drawing goes into the cache until present_frame
+static bool begin_frame(State *state, FrameSnapshot *snapshot, bool map_view) {
+    FrameCache *frame = &state->frame;
+    FrameKey key = get_frame_key(state, snapshot, map_view);
+    if (frame->valid && frame_key_eq(frame->key, key)) {
+        return false;
+    }
+    frame->key = key;
+    frame->valid = true;
+    gfx_begin_scene();
+    return true;
+}
+
+#if PROFILE
+// a line per zone, the bar is the average and the tick the 99th percentile
+// against the frame budget at 60 fps
+static void draw_profile_overlay(void) {
+    const float budget_ms = 1000.0f / 60.0f;
+    const int line = 14;
+    const int bar_width = 120;
+    int y = 4;
+    gfx_rect((Rectangle) { 0, 0, 420, (PROFILE_ZONE_COUNT * line) + 8 }, (Color) { 0, 0, 0, 192 });
+    for (int zone = 0; zone < PROFILE_ZONE_COUNT; zone++) {
+        ProfileStats stats = get_profile_stats(zone);
+        char text[96];
+        snprintf(text, sizeof(text), "%-9s %6.2f %6.2f %6.2f %5.1f",
+            get_profile_zone_name(zone), stats.min, stats.avg, stats.p99, stats.calls
+        );
+        gfx_text(text, 4, y, 10, RAYWHITE);
+        float avg = (stats.avg / budget_ms) * bar_width;
+        float p99 = (stats.p99 / budget_ms) * bar_width;
+        gfx_rect((Rectangle) { 290, y + 2, (avg < bar_width) ? avg : bar_width, line - 6 }, GREEN);
+        gfx_rect((Rectangle) { 290 + ((p99 < bar_width) ? p99 : bar_width), y, 2, line - 2 }, RED);
+        y += line;
+    }
+}
+
+// the cells the search expanded first are blue, the last ones red
+static void draw_astar_heatmap(State *state, FrameSnapshot *snapshot) {
+    for (int y = 0; y < GAME_HEIGHT; y++) {
+        for (int x = 0; x < GAME_WIDTH; x++) {
+            int heat = snapshot->astar_heat[x + (y * GAME_WIDTH)];
+            if (heat == 0) {
+                continue;
+            }
+            Cell cell = cell_add(snapshot->game_offset, (Cell) { x, y });
+            draw_cell(state, snapshot, cell, (Color) { heat, 0, 255 - heat, 96 });
         }
+    }
+    AStarRecord *search = &snapshot->astar_search;
+    char text[128];
+    snprintf(text, sizeof(text), "%s: %d expanded, %d peak open, length %d, %.3f ms",
+        get_astar_site_name(search->site), search->expanded, search->peak_open, search->path_length, search->ms
+    );
+    int y = gfx_screen_height() - 14;
+    gfx_rect((Rectangle) { 0, y - 2, 420, 14 }, (Color) { 0, 0, 0, 192 });
+    gfx_text(text, 4, y, 10, RAYWHITE);
+}
+#endif
+
+static void present_frame(State *state, bool redrawn) {
+    if (redrawn) {
+        gfx_end_scene();
+    }
+    gfx_begin_present();
+    #if PROFILE
+    if (is_profile_overlay_shown()) {
+        draw_profile_overlay();
+    }
+    #endif
+    gfx_end_present();
+}
+
+void unload_frame_cache(FrameCache *frame) {
+    gfx_unload_scene();
+    frame->valid = false;
+}
+
+bool render(State *state, FrameSnapshot *snapshot) {
+    bool redrawn = begin_frame(state, snapshot, false);
+    if (!redrawn) {
+        present_frame(state, false);
+        return false;
+    }
+
+    gfx_clear(COLOR_UNDISCOVERED);
+
+    update_tile_layer(snapshot, &state->tiles);
+    draw_tile_layer(state, snapshot, &state->tiles);
+
+    if (!snapshot->mouse_reachable) {
+        draw_cell(state, snapshot, snapshot->mouse_current, RED);
     } else {
-        switch (c->direction) {
-        case ORTHAGONAL_N: pupil.y = -off; break;
-        case ORTHAGONAL_W: pupil.x = -off; break;
-        case ORTHAGONAL_S: pupil.y = off; break;
-        case ORTHAGONAL_E: pupil.x = off; break;
+        for (int i = 0; i < snapshot->path_length; i++) {
+            draw_cell(state, snapshot, snapshot->path[i], COLOR_PLAYER_PATH);
         }
     }
 
-    DrawCircle(body.x + pupil.x + pupil.x, body.y + pupil.y + pupil.y, pupil_radius, BLACK);
+    draw_creatures(state, snapshot);
+
+    #if PROFILE
+    if (is_astar_heatmap_shown()) {
+        draw_astar_heatmap(state, snapshot);
+    }
+    #endif
+
+    present_frame(state, true);
+    return true;
+}
+
+static inline int map_level_width(int level) {
+    return (GRID_WIDTH >> level) > 0 ? (GRID_WIDTH >> level) : 1;
 }
 
-void render(State *state) {
-    BeginDrawing();
+static inline int map_level_height(int level) {
+    return (GRID_HEIGHT >> level) > 0 ? (GRID_HEIGHT >> level) : 1;
+}
 
-    ClearBackground(COLOR_UNDISCOVERED);
+static void load_map_overview(MapOverview *overview) {
+    int width = gfx_screen_width();
+    int height = gfx_screen_height();
+    overview->level = 0;
+    while (overview->level < MAP_LEVELS - 1 &&
+        (map_level_width(overview->level) > width || map_level_height(overview->level) > height)
+    ) {
+        overview->level++;
+    }
+    for (int level = 0; level < MAP_LEVELS; level++) {
+        overview->levels[level] = (Color *)calloc(map_level_width(level) * map_level_height(level), sizeof(Color));
+    }
+    overview->image = gfx_load_image(map_level_width(overview->level), map_level_height(overview->level), COLOR_UNDISCOVERED);
+    for (int i = 0; i < CHUNK_AMOUNT; i++) {
+        overview->chunk_versions[i] = 0;
+    }
+    overview->loaded = true;
+}
 
-    Cell min = {
-        (state->game_offset.x >= 0) ? state->game_offset.x : 0,
-        (state->game_offset.y >= 0) ? state->game_offset.y : 0
-    };
-    Cell game_max = {
-        state->game_offset.x + GAME_WIDTH,
-        state->game_offset.y + GAME_HEIGHT
-    };
-    Cell max = {
-        (game_max.x < GRID_WIDTH) ? game_max.x : GRID_WIDTH,
-        (game_max.y < GRID_HEIGHT) ? game_max.y : GRID_HEIGHT,
+void unload_map_overview(MapOverview *overview) {
+    if (!overview->loaded) {
+        return;
+    }
+    gfx_unload_image(overview->image);
+    for (int level = 0; level < MAP_LEVELS; level++) {
+        free(overview->levels[level]);
+    }
+    overview->loaded = false;
+}
+
+static Color average_color(Color a, Color b, Color c, Color d) {
+    return (Color) {
+        (a.r + b.r + c.r + d.r) / 4,
+        (a.g + b.g + c.g + d.g) / 4,
+        (a.b + b.b + c.b + d.b) / 4,
+        (a.a + b.a + c.a + d.a) / 4,
     };
-    for (int x = min.x; x < max.x; x++) {
+}
+
+// refreshes the cells of one chunk on every level of the pyramid and uploads
+// the part of the level that is shown
+static void update_map_chunk(FrameSnapshot *snapshot, MapOverview *overview, int chunk) {
+    Cell min = { (chunk % CHUNK_COLUMNS) * CHUNK_SIZE, (chunk / CHUNK_COLUMNS) * CHUNK_SIZE };
+    Cell max = { min.x + CHUNK_SIZE, min.y + CHUNK_SIZE };
+
+    Color *base = overview->levels[0];
+    for (int y = min.y; y < max.y; y++) {
+        for (int x = min.x; x < max.x; x++) {
+            base[x + (y * GRID_WIDTH)] = get_cell_color(snapshot->grid[x][y]);
+        }
+    }
+
+    for (int level = 1; level <= overview->level; level++) {
+        int width = map_level_width(level);
+        int height = map_level_height(level);
+        int below_width = map_level_width(level - 1);
+        int below_height = map_level_height(level - 1);
+        Color *below = overview->levels[level - 1];
+        Color *pixels = overview->levels[level];
+        min = (Cell) { min.x / 2, min.y / 2 };
+        max = (Cell) {
+            ((max.x + 1) / 2 < width) ? (max.x + 1) / 2 : width,
+            ((max.y + 1) / 2 < height) ? (max.y + 1) / 2 : height,
+        };
         for (int y = min.y; y < max.y; y++) {
-            int cell = state->grid[x][y];
-            if (has_flag(cell, CELL_FLAG_DISCOVERED)) {
-                bool visible = has_flag(cell, CELL_FLAG_VISIBLE);
-                bool wall = has_flag(cell, CELL_FLAG_WALL);
-                Color color;
-                if (visible) {
-                    color = wall ? COLOR_WALL_VISIBLE : COLOR_GROUND_VISIBLE;
-                } else {
-                    color = wall ? COLOR_WALL_INVISIBLE : COLOR_GROUND_INVISIBLE;
-                }
-                draw_cell(state, (Cell) { x, y }, color);
+            for (int x = min.x; x < max.x; x++) {
+                int x0 = x * 2;
+                int y0 = y * 2;
+                int x1 = (x0 + 1 < below_width) ? x0 + 1 : x0;
+                int y1 = (y0 + 1 < below_height) ? y0 + 1 : y0;
+                pixels[x + (y * width)] = average_color(
+                    below[x0 + (y0 * below_width)],
+                    below[x1 + (y0 * below_width)],
+                    below[x0 + (y1 * below_width)],
+                    below[x1 + (y1 * below_width)]
+                );
             }
         }
     }
 
-    Cell player_path = astar_path(state, state->player.position, state->mouse_current, CELL_FLAG_PLAYER_WALKABLE);
-    bool player_path_found = cell_neq(player_path, state->player.position);
-    bool mouse_cell_discovered = !has_flag(state->grid[state->mouse_current.x][state->mouse_current.y], CELL_FLAG_DISCOVERED);
-    if (!player_path_found || mouse_cell_discovered) {
-        draw_cell(state, state->mouse_current, RED);
-    } else {
-        if (!has_flag(state->flags, GAME_FLAG_IS_MOVING)) {
-            draw_cell(state, state->player.position, COLOR_PLAYER_PATH);
-            draw_cell(state, player_path, COLOR_PLAYER_PATH);
-        }
-        while (!has_flag(state->flags, GAME_FLAG_IS_MOVING) && cell_neq(player_path, state->mouse_current)) {
-            player_path = astar_path(state, player_path, state->mouse_current, CELL_FLAG_PLAYER_WALKABLE);
-            draw_cell(state, player_path, COLOR_PLAYER_PATH);
+    int width = map_level_width(overview->level);
+    Color *pixels = overview->levels[overview->level];
+    int i = 0;
+    for (int y = min.y; y < max.y; y++) {
+        for (int x = min.x; x < max.x; x++) {
+            overview->upload[i++] = pixels[x + (y * width)];
         }
     }
+    Rectangle rec = { min.x, min.y, max.x - min.x, max.y - min.y };
+    gfx_update_image(overview->image, rec, overview->upload);
+}
 
-    draw_creature(state, &state->player);
+bool draw_map_only(State *state, FrameSnapshot *snapshot) {
+    bool redrawn = begin_frame(state, snapshot, true);
+    if (!redrawn) {
+        present_frame(state, false);
+        return false;
+    }
 
-    for (int i = 0; i < CREATURE_CAPACITY; i++) {
-        Creature *c = &state->creatures[i];
-        if (!has_flag(c->flags, CREATURE_FLAG_VISIBLE) ||
-            c->position.x < state->game_offset.x ||
-            c->position.x > state->game_offset.x + GAME_WIDTH ||
-            c->position.y < state->game_offset.y ||
-            c->position.y > state->game_offset.y + GAME_HEIGHT
-        ) {
-            continue;
-        }
-        draw_creature(state, c);
-    }
-
-    EndDrawing();
-}
-
-void draw_map_only(State *state) {
-    int w = GetScreenWidth() / GRID_WIDTH;
-    int h = GetScreenHeight() / GRID_HEIGHT;
-    BeginDrawing();
-    for (int x = 0; x < GRID_WIDTH; x++) {
-        for (int y = 0; y < GRID_HEIGHT; y++) {
-            Rectangle rec = {
-                .x = w * x,
-                .y = h * y,
-                .width = w,
-                .height = h
-            };
-            int cell = state->grid[x][y];
-            bool visible = has_flag(cell, CELL_FLAG_VISIBLE);
-            bool wall = has_flag(cell, CELL_FLAG_WALL);
-            Color color;
-            if (visible) {
-                color = wall ? COLOR_WALL_VISIBLE : COLOR_GROUND_VISIBLE;
-            } else {
-                color = wall ? COLOR_WALL_INVISIBLE : COLOR_GROUND_INVISIBLE;
-            }
-            DrawRectangleRec(rec, color);
+    MapOverview *overview = &state->overview;
+    if (!overview->loaded) {
+        load_map_overview(overview);
+    }
+    for (int i = 0; i < CHUNK_AMOUNT; i++) {
+        if (overview->chunk_versions[i] != snapshot->chunk_versions[i]) {
+            overview->chunk_versions[i] = snapshot->chunk_versions[i];
+            update_map_chunk(snapshot, overview, i);
         }
     }
-    EndDrawing();
-}
\ No newline at end of file
+
+    int w = gfx_screen_width() / GRID_WIDTH;
+    int h = gfx_screen_height() / GRID_HEIGHT;
+    Rectangle source = { 0, 0, map_level_width(overview->level), map_level_height(overview->level) };
+    Rectangle dest = {
+        .x = 0,
+        .y = 0,
+        .width = (w > 0) ? (w * GRID_WIDTH) : gfx_screen_width(),
+        .height = (h > 0) ? (h * GRID_HEIGHT) : gfx_screen_height(),
+    };
+    gfx_clear(COLOR_UNDISCOVERED);
+    gfx_draw_image(overview->image, source, dest);
+
+    present_frame(state, true);
+    return true;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "main.h"
+
+// a recording is the seed plus every input the simulation acted on, in order,
+// with get_state_hash after each one. since all randomness comes from the
+// seed, replaying the entries on a fresh game must reproduce every hash
+
+#define RECORDING_MAGIC 0x31434552u
+#define RECORDING_VERSION 3
+
+void start_recording(Recording *r, uint32 seed) {
+    r->active = true;
+    r->seed = seed;
+    r->count = 0;
+}
+
+void free_recording(Recording *r) {
+    free(r->entries);
+    *r = (Recording) { 0 };
+}
+
+// called by the simulation after it handled a settle, a turn request or both
+void record_command(State *state, SimCommand *command, bool settle, bool turn) {
+    Recording *r = &state->recording;
+    if (!r->active || (!settle && !turn)) {
+        return;
+    }
+    if (r->count == r->capacity) {
+        r->capacity = (r->capacity > 0) ? r->capacity * 2 : 1024;
+        r->entries = (RecordingEntry *)realloc(r->entries, r->capacity * sizeof(RecordingEntry));
+    }
+    RecordingEntry *entry = &r->entries[r->count++];
+    entry->action = turn ? command->action : TURN_ACTION_NONE;
+    entry->settle = settle;
+    entry->direction = command->direction;
+    entry->target = command->target;
+    entry->hash = get_state_hash(state);
+}
+
+static void write_u32(FILE *file, uint32 value) {
+    uint8 bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+    fwrite(bytes, 1, 4, file);
+}
+
+static void write_u64(FILE *file, uint64 value) {
+    write_u32(file, (uint32)value);
+    write_u32(file, (uint32)(value >> 32));
+}
+
+static bool read_u32(FILE *file, uint32 *value) {
+    uint8 bytes[4];
+    if (fread(bytes, 1, 4, file) != 4) {
+        return false;
+    }
+    *value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32)bytes[3] << 24);
+    return true;
+}
+
+static bool read_u64(FILE *file, uint64 *value) {
+    uint32 low, high;
+    if (!read_u32(file, &low) || !read_u32(file, &high)) {
+        return false;
+    }
+    *value = low | ((uint64)high << 32);
+    return true;
+}
+
+// little endian: magic, version, seed, entry count, then per entry one byte
+// with the action in bits 0-2, settle in bit 3 and the direction in bits 4-5,
+// the click target as two 16 bit coordinates for clicks only, and the hash
+bool save_recording(Recording *r, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    write_u32(file, RECORDING_MAGIC);
+    write_u32(file, RECORDING_VERSION);
+    write_u32(file, r->seed);
+    write_u32(file, r->count);
+    for (int i = 0; i < r->count; i++) {
+        RecordingEntry *entry = &r->entries[i];
+        uint8 op = entry->action | (entry->settle << 3) | ((entry->direction & 3) << 4);
+        fputc(op, file);
+        if (entry->action == TURN_ACTION_CLICK) {
+            uint8 target[4] = { entry->target.x, entry->target.x >> 8, entry->target.y, entry->target.y >> 8 };
+            fwrite(target, 1, 4, file);
+        }
+        write_u64(file, entry->hash);
+    }
+    return fclose(file) == 0;
+}
+
+bool load_recording(Recording *r, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    uint32 magic, version, count;
+    *r = (Recording) { 0 };
+    bool ok = (
+        read_u32(file, &magic) && magic == RECORDING_MAGIC &&
+        read_u32(file, &version) && version == RECORDING_VERSION &&
+        read_u32(file, &r->seed) &&
+        read_u32(file, &count)
+    );
+    if (ok) {
+        r->capacity = (count > 0) ? count : 1;
+        r->entries = (RecordingEntry *)malloc(r->capacity * sizeof(RecordingEntry));
+    }
+    for (uint32 i = 0; ok && i < count; i++) {
+        RecordingEntry *entry = &r->entries[i];
+        int op = fgetc(file);
+        ok = op != EOF;
+        entry->action = op & 7;
+        entry->settle = (op >> 3) & 1;
+        entry->direction = (op >> 4) & 3;
+        entry->target = INVALID_CELL;
+        if (ok && entry->action == TURN_ACTION_CLICK) {
+            uint8 target[4];
+            ok = fread(target, 1, 4, file) == 4;
+            entry->target = (Cell) { (int16_t)(target[0] | (target[1] << 8)), (int16_t)(target[2] | (target[3] << 8)) };
+        }
+        ok = ok && read_u64(file, &entry->hash);
+        r->count = i + 1;
+    }
+    fclose(file);
+    if (!ok) {
+        free_recording(r);
+    }
+    return ok;
+}
+
+// runs the entries on a game that was just initialized from r->seed and
+// returns the index of the first entry whose hash differs, or -1
+int replay_recording(State *state, Recording *r) {
+    for (int i = 0; i < r->count; i++) {
+        RecordingEntry *entry = &r->entries[i];
+        if (entry->settle) {
+            hide_unseen_creatures(state);
+        }
+        if (entry->action != TURN_ACTION_NONE) {
+            SimCommand command = {
+                .action = entry->action,
+                .direction = entry->direction,
+                .target = entry->target,
+            };
+            TRACE_BEGIN("turn");
+            run_turn(state, &command);
+            TRACE_END("turn");
+        }
+        if (get_state_hash(state) != entry->hash) {
+            return i;
+        }
+        #if DEBUG
+        if (get_state_hash(state) != compute_state_hash(state)) {
+            printf("incremental state hash is stale after entry %d\n", i);
+        }
+        #endif
+    }
+    return -1;
+}
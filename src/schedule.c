@@ -0,0 +1,44 @@
+#include "main.h"
+
+// time between two actions of a creature. every type acts once per player
+// action for now, a faster or slower one only needs its own cost here
+int creature_action_cost(CreatureType type) {
+    (void)type;
+    return ACTION_COST;
+}
+
+void schedule_init(Schedule *s) {
+    s->now = 0;
+    for (int i = 0; i < SCHEDULE_SLOTS; i++) {
+        s->slots[i] = NO_CREATURE;
+    }
+    for (int i = 0; i < CREATURE_CAPACITY; i++) {
+        s->next[i] = NO_CREATURE;
+        s->scheduled[i] = false;
+    }
+}
+
+void schedule_add(Schedule *s, int idx, uint32 time) {
+    if (time < s->now) {
+        time = s->now;
+    } else if (time - s->now >= SCHEDULE_SLOTS) {
+        time = s->now + SCHEDULE_SLOTS - 1;
+    }
+    int slot = time % SCHEDULE_SLOTS;
+    s->action_time[idx] = time;
+    s->scheduled[idx] = true;
+    s->next[idx] = s->slots[slot];
+    s->slots[slot] = idx;
+}
+
+// detaches the whole slot for the current tick and returns its first creature,
+// the rest of the list is reached through s->next
+int schedule_take(Schedule *s) {
+    int slot = s->now % SCHEDULE_SLOTS;
+    int first = s->slots[slot];
+    s->slots[slot] = NO_CREATURE;
+    for (int i = first; i != NO_CREATURE; i = s->next[i]) {
+        s->scheduled[i] = false;
+    }
+    return first;
+}
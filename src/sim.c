@@ -0,0 +1,277 @@
+#include <pthread.h>
+#include <string.h>
+#include "main.h"
+
+// one player action followed by every creature action due before the next one.
+// a click on a cell the player cannot reach does nothing and takes no turn.
+// undo takes the most recent turn back instead
+void run_turn(State *state, SimCommand *command) {
+    Creature *player = &state->player;
+    switch (command->action) {
+    case TURN_ACTION_NONE: {
+        return;
+    } break;
+    case TURN_ACTION_UNDO: {
+        undo_turn(state);
+        return;
+    } break;
+    case TURN_ACTION_CLICK: {
+        Cell first = astar_path(state, player->position, command->target, CELL_FLAG_PLAYER_WALKABLE, ASTAR_SITE_CLICK);
+        if (cell_eq(first, player->position)) {
+            return;
+        }
+    } break;
+    case TURN_ACTION_CONTINUE: {
+        if (!has_flag(state->flags, GAME_FLAG_IS_MOVING)) {
+            return;
+        }
+    } break;
+    case TURN_ACTION_WAIT:
+    case TURN_ACTION_STEP: break;
+    }
+
+    begin_undo_turn(state);
+    save_creature_for_undo(state, HASH_SLOT_PLAYER);
+    if (command->action == TURN_ACTION_CLICK) {
+        state->mouse_target = command->target;
+        state->flags |= GAME_FLAG_IS_MOVING;
+    }
+
+    player->previous_position = player->position;
+
+    if (command->action == TURN_ACTION_WAIT) {
+        state->flags &= ~GAME_FLAG_IS_MOVING;
+    } else {
+        if (command->action == TURN_ACTION_STEP) {
+            state->flags &= ~GAME_FLAG_IS_MOVING;
+            Cell requested_cell = get_cell_in_direction(player->previous_position, command->direction, 1);
+            if (is_cell_valid(state, requested_cell, CELL_FLAG_WALKABLE)) {
+                player->position = requested_cell;
+            }
+        } else {
+            player->position = astar_path(state, player->previous_position, state->mouse_target, CELL_FLAG_PLAYER_WALKABLE, ASTAR_SITE_MOVE);
+            if (cell_eq(player->position, state->mouse_target)) {
+                state->flags &= ~GAME_FLAG_IS_MOVING;
+            }
+        }
+        update_creature_direction(player);
+
+        set_invisible(state);
+        update_game_offset(state);
+        page_in_world(state);
+        discover_visible_cells(state);
+
+        int flags = state->grid[player->position.x][player->position.y];
+        if (has_flag(flags, CELL_FLAG_STAIRS)) {
+            change_level(state, state->depth + 1);
+        } else if (has_flag(flags, CELL_FLAG_STAIRS_UP)) {
+            change_level(state, state->depth - 1);
+        }
+    }
+    rehash_creature(state, HASH_SLOT_PLAYER);
+
+    update_creatures(state, creature_action_cost(player->type));
+    store_world(state);
+}
+
+static inline CreatureSnapshot get_creature_snapshot(Creature *c) {
+    return (CreatureSnapshot) {
+        .type = c->type,
+        .direction = c->direction,
+        .previous_position = c->previous_position,
+        .position = c->position,
+    };
+}
+
+static inline bool is_creature_on_screen(State *state, Creature *c) {
+    return (
+        has_flag(c->flags, CREATURE_FLAG_VISIBLE) &&
+        c->position.x >= state->game_offset.x &&
+        c->position.x <= state->game_offset.x + GAME_WIDTH &&
+        c->position.y >= state->game_offset.y &&
+        c->position.y <= state->game_offset.y + GAME_HEIGHT
+    );
+}
+
+// the path preview is walked here instead of in the renderer so the main
+// thread never runs a search, and only when the mouse cell or the turn changes
+static void capture_path_preview(State *state, FrameSnapshot *snapshot) {
+    Cell start = state->player.position;
+    Cell goal = state->mouse_current;
+    snapshot->path_length = 0;
+    Cell step = astar_path(state, start, goal, CELL_FLAG_PLAYER_WALKABLE, ASTAR_SITE_PREVIEW);
+    snapshot->mouse_reachable = (
+        cell_neq(step, start) &&
+        has_flag(state->grid[goal.x][goal.y], CELL_FLAG_DISCOVERED)
+    );
+    if (!snapshot->mouse_reachable || has_flag(state->flags, GAME_FLAG_IS_MOVING)) {
+        return;
+    }
+    snapshot->path[snapshot->path_length++] = start;
+    snapshot->path[snapshot->path_length++] = step;
+    while (cell_neq(step, goal) && snapshot->path_length < PATH_PREVIEW_CAPACITY) {
+        step = astar_path(state, step, goal, CELL_FLAG_PLAYER_WALKABLE, ASTAR_SITE_PREVIEW);
+        snapshot->path[snapshot->path_length++] = step;
+    }
+}
+
+void capture_snapshot(State *state, FrameSnapshot *snapshot, uint32 sequence, uint32 settle) {
+    snapshot->version = ++state->sim.published;
+    snapshot->sequence = sequence;
+    snapshot->settle = settle;
+    snapshot->turn = state->turn;
+    snapshot->flags = state->flags;
+    snapshot->game_offset = state->game_offset;
+    snapshot->mouse_current = state->mouse_current;
+    capture_path_preview(state, snapshot);
+    #if PROFILE
+    capture_astar_heatmap(state, snapshot);
+    #endif
+
+    snapshot->player = get_creature_snapshot(&state->player);
+    snapshot->creature_count = 0;
+    Cell chunk_min, chunk_max;
+    get_viewport_chunks(state, 0, &chunk_min, &chunk_max);
+    for (int cy = chunk_min.y; cy < chunk_max.y; cy++) {
+        for (int cx = chunk_min.x; cx < chunk_max.x; cx++) {
+            int chunk = cx + (cy * CHUNK_COLUMNS);
+            for (int i = state->chunks.head[chunk]; i != NO_CREATURE; i = state->chunks.next[i]) {
+                Creature *c = &state->creatures[i];
+                if (is_creature_on_screen(state, c)) {
+                    snapshot->creatures[snapshot->creature_count++] = get_creature_snapshot(c);
+                }
+            }
+        }
+    }
+
+    for (int y = 0; y < GAME_HEIGHT; y++) {
+        for (int x = 0; x < GAME_WIDTH; x++) {
+            Cell cell = { state->game_offset.x + x, state->game_offset.y + y };
+            Color color = COLOR_UNDISCOVERED;
+            if (!is_cell_out_of_bounds(state, cell)) {
+                int flags = state->grid[cell.x][cell.y];
+                if (has_flag(flags, CELL_FLAG_DISCOVERED)) {
+                    color = get_cell_color(flags);
+                }
+            }
+            snapshot->tiles[x + (y * GAME_WIDTH)] = color;
+        }
+    }
+
+    // only the map overview reads the grid. a slot still holds the grid from
+    // the last time it was written, so it takes the chunks changed since then,
+    // none when the grid did not change, like on a mouse move
+    if (!snapshot->grid_captured || snapshot->grid_version != state->grid_version) {
+        copy_changed_chunks(state, snapshot->grid, snapshot->chunk_versions, !snapshot->grid_captured);
+        snapshot->grid_version = state->grid_version;
+        snapshot->grid_captured = true;
+    }
+}
+
+static void init_snapshot_buffer(SnapshotBuffer *b) {
+    b->write = 0;
+    b->middle = 1;
+    b->read = 2;
+}
+
+// writer side, hands the slot that was just filled to the reader
+static void publish_snapshot(SnapshotBuffer *b) {
+    int previous = __atomic_exchange_n(&b->middle, b->write | SNAPSHOT_FRESH, __ATOMIC_ACQ_REL);
+    b->write = previous & ~SNAPSHOT_FRESH;
+}
+
+// reader side, returns the newest published snapshot. the returned slot stays
+// untouched by the writer until the next call
+FrameSnapshot *acquire_snapshot(SnapshotBuffer *b) {
+    if (__atomic_load_n(&b->middle, __ATOMIC_ACQUIRE) & SNAPSHOT_FRESH) {
+        int previous = __atomic_exchange_n(&b->middle, b->read, __ATOMIC_ACQ_REL);
+        b->read = previous & ~SNAPSHOT_FRESH;
+    }
+    return &b->slots[b->read];
+}
+
+static void *sim_main(void *arg) {
+    State *state = (State *)arg;
+    SimThread *sim = &state->sim;
+    SimCommand handled = sim->pending;
+    TRACE_THREAD("sim");
+    while (true) {
+        pthread_mutex_lock(&sim->mutex);
+        while (!sim->quit &&
+            sim->pending.sequence == handled.sequence &&
+            sim->pending.settle == handled.settle &&
+            cell_eq(sim->pending.mouse_current, handled.mouse_current)
+        ) {
+            pthread_cond_wait(&sim->wake, &sim->mutex);
+        }
+        if (sim->quit) {
+            pthread_mutex_unlock(&sim->mutex);
+            return 0;
+        }
+        SimCommand command = sim->pending;
+        pthread_mutex_unlock(&sim->mutex);
+
+        bool settle = command.settle != handled.settle;
+        bool turn = command.sequence != handled.sequence;
+        if (settle) {
+            hide_unseen_creatures(state);
+        }
+        if (turn) {
+            PROFILE_BEGIN(TURN);
+            TRACE_BEGIN("turn");
+            run_turn(state, &command);
+            TRACE_END("turn");
+            PROFILE_END(TURN);
+            autosave_turn(state);
+        }
+        record_command(state, &command, settle, turn);
+        state->mouse_current = command.mouse_current;
+        handled = command;
+
+        SnapshotBuffer *b = &sim->snapshots;
+        PROFILE_BEGIN(SNAPSHOT);
+        TRACE_BEGIN("snapshot");
+        capture_snapshot(state, &b->slots[b->write], handled.sequence, handled.settle);
+        TRACE_END("snapshot");
+        PROFILE_END(SNAPSHOT);
+        publish_snapshot(b);
+    }
+}
+
+// the first snapshot is captured before the thread starts so the reader
+// always has a complete one
+void sim_start(State *state) {
+    SimThread *sim = &state->sim;
+    sim->quit = false;
+    sim->pending = (SimCommand) {
+        .mouse_current = state->mouse_current,
+    };
+    init_snapshot_buffer(&sim->snapshots);
+    capture_snapshot(state, &sim->snapshots.slots[sim->snapshots.read], 0, 0);
+    pthread_mutex_init(&sim->mutex, 0);
+    pthread_cond_init(&sim->wake, 0);
+    pthread_create(&sim->thread, 0, sim_main, state);
+    sim->running = true;
+}
+
+void sim_stop(State *state) {
+    SimThread *sim = &state->sim;
+    if (!sim->running) {
+        return;
+    }
+    pthread_mutex_lock(&sim->mutex);
+    sim->quit = true;
+    pthread_cond_signal(&sim->wake);
+    pthread_mutex_unlock(&sim->mutex);
+    pthread_join(sim->thread, 0);
+    pthread_cond_destroy(&sim->wake);
+    pthread_mutex_destroy(&sim->mutex);
+    sim->running = false;
+}
+
+void sim_send(SimThread *sim, SimCommand *command) {
+    pthread_mutex_lock(&sim->mutex);
+    sim->pending = *command;
+    pthread_cond_signal(&sim->wake);
+    pthread_mutex_unlock(&sim->mutex);
+}
@@ -0,0 +1,118 @@
+#include <math.h>
+#include "main.h"
+
+static void raster_evil_triangle(Canvas *canvas, Vector2 center, float size, float time, Color color) {
+    const float d = (2.0f * PI) / 3.0f;
+    Vector2 v[3];
+    for (int i = 0; i < 3; i++) {
+        float value = (d * i) + (time * d);
+        v[i] = (Vector2) {
+            .x = center.x + (sin(value) * HALF_CELLSIZE * size),
+            .y = center.y + (cos(value) * HALF_CELLSIZE * size),
+        };
+    }
+    raster_triangle(canvas, v[0], v[1], v[2], color);
+}
+
+static void raster_creature_body(Canvas *canvas, Vector2 center, CreatureType type, float time) {
+    switch (type) {
+    case CREATURE_PLAYER: {
+        raster_circle(canvas, center, HALF_CELLSIZE, COLOR_CREATURE_PLAYER);
+    } break;
+    case CREATURE_DIGGER: {
+        Rectangle rec = { center.x - HALF_CELLSIZE, center.y - HALF_CELLSIZE, CELLSIZE, CELLSIZE };
+        raster_rect(canvas, rec, GREEN);
+    } break;
+    case CREATURE_EVIL_TRIANGLE: {
+        raster_evil_triangle(canvas, center, 1.0f, time, COLOR_CREATURE_ENEMY);
+    } break;
+    case CREATURE_BIG_EVIL_TRIANGLE: {
+        raster_evil_triangle(canvas, center, 1.5f, time, COLOR_CREATURE_ENEMY2);
+    } break;
+    }
+}
+
+// direction is ORTHAGONAL_* or DIAGONAL_* depending on the type, anything
+// else looks straight ahead
+static void raster_creature_eye(Canvas *canvas, Vector2 center, CreatureType type, int direction) {
+    int eye_radius = 0;
+    bool diagonal_eye = false;
+    switch (type) {
+    case CREATURE_PLAYER: eye_radius = 0.3f * CELLSIZE; break;
+    case CREATURE_DIGGER: return;
+    case CREATURE_EVIL_TRIANGLE: eye_radius = 0.2f * CELLSIZE; diagonal_eye = true; break;
+    case CREATURE_BIG_EVIL_TRIANGLE: eye_radius = 0.3f * CELLSIZE; break;
+    }
+
+    raster_circle(canvas, center, eye_radius, WHITE);
+
+    int pupil_radius = eye_radius * 0.4f;
+    Cell pupil = {0,0};
+    int off = eye_radius * 0.25f;
+    if (diagonal_eye) {
+        switch (direction) {
+        case DIAGONAL_NE: pupil.x = off; pupil.y = -off; break;
+        case DIAGONAL_NW: pupil.x = -off; pupil.y = -off; break;
+        case DIAGONAL_SW: pupil.x = -off; pupil.y = off; break;
+        case DIAGONAL_SE: pupil.x = off; pupil.y = off; break;
+        }
+    } else {
+        switch (direction) {
+        case ORTHAGONAL_N: pupil.y = -off; break;
+        case ORTHAGONAL_W: pupil.x = -off; break;
+        case ORTHAGONAL_S: pupil.y = off; break;
+        case ORTHAGONAL_E: pupil.x = off; break;
+        }
+    }
+
+    Vector2 pupil_center = { center.x + pupil.x + pupil.x, center.y + pupil.y + pupil.y };
+    raster_circle(canvas, pupil_center, pupil_radius, BLACK);
+}
+
+static inline Rectangle sprite_rec(int column, int row) {
+    return (Rectangle) { column * SPRITE_SIZE, row * SPRITE_SIZE, SPRITE_SIZE, SPRITE_SIZE };
+}
+
+// rasterizes every body frame and eye once, after that a creature is two quads
+void load_sprite_atlas(SpriteAtlas *atlas) {
+    int columns = SPRITE_ANIMATION_FRAMES + SPRITE_EYE_VARIANTS;
+    Canvas canvas = load_canvas(columns * SPRITE_SIZE, SPRITE_TYPES * SPRITE_SIZE, BLANK);
+    for (int type = 0; type < SPRITE_TYPES; type++) {
+        for (int frame = 0; frame < SPRITE_ANIMATION_FRAMES; frame++) {
+            Rectangle rec = sprite_rec(frame, type);
+            Vector2 center = { rec.x + (SPRITE_SIZE / 2), rec.y + (SPRITE_SIZE / 2) };
+            raster_creature_body(&canvas, center, type, (float)frame / SPRITE_ANIMATION_FRAMES);
+        }
+        for (int direction = 0; direction < SPRITE_EYE_VARIANTS; direction++) {
+            Rectangle rec = sprite_rec(SPRITE_ANIMATION_FRAMES + direction, type);
+            Vector2 center = { rec.x + (SPRITE_SIZE / 2), rec.y + (SPRITE_SIZE / 2) };
+            raster_creature_eye(&canvas, center, type, direction);
+        }
+    }
+    atlas->image = gfx_load_image(canvas.width, canvas.height, BLANK);
+    gfx_update_image(atlas->image, (Rectangle) { 0, 0, canvas.width, canvas.height }, canvas.pixels);
+    unload_canvas(&canvas);
+    atlas->loaded = true;
+}
+
+void unload_sprite_atlas(SpriteAtlas *atlas) {
+    if (!atlas->loaded) {
+        return;
+    }
+    gfx_unload_image(atlas->image);
+    atlas->loaded = false;
+}
+
+static inline int get_animation_frame(float animation_timer) {
+    int frame = (animation_timer / TIME_PER_ANIMATION) * SPRITE_ANIMATION_FRAMES;
+    return (frame < SPRITE_ANIMATION_FRAMES) ? frame : SPRITE_ANIMATION_FRAMES - 1;
+}
+
+Rectangle get_body_sprite(CreatureType type, int frame) {
+    return sprite_rec(frame, type);
+}
+
+Rectangle get_eye_sprite(CreatureType type, int direction) {
+    int variant = (direction < SPRITE_EYE_VARIANTS - 1) ? direction : SPRITE_EYE_VARIANTS - 1;
+    return sprite_rec(SPRITE_ANIMATION_FRAMES + variant, type);
+}
@@ -0,0 +1,316 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "map.c"
+#include "vision.c"
+#include "movement.c"
+#include "jobs.c"
+#include "schedule.c"
+#include "cooperative.c"
+#include "creatures.c"
+#include "undo.c"
+#include "hash.c"
+#include "game.c"
+#include "level.c"
+#include "levels.c"
+#include "platform.c"
+#include "profile.c"
+#include "trace.c"
+#include "work.c"
+#include "world.c"
+#include "autosave.c"
+#include "replay.c"
+#include "sim.c"
+
+// plays the game in an ansi terminal, for servers reached over ssh. every game
+// cell is two terminal columns with the tile colour as background and a glyph
+// for the creature on it. a shadow copy of what the terminal shows is kept so
+// a frame only sends the cells that changed
+//
+//   terminal --seed 8              arrows/wasd/hjkl move, space waits, u undoes, q quits
+//   terminal --seed 8 --turns 200  waits 200 turns and reports bytes per turn
+
+#define TERMINAL_BUFFER_SIZE (1 << 16)
+
+typedef struct TerminalCell {
+    char glyph;
+    Color fg;
+    Color bg;
+} TerminalCell;
+
+typedef struct Terminal {
+    bool valid;
+    Cell offset;
+    TerminalCell shadow[GAME_HEIGHT][GAME_WIDTH];
+    Cell cursor;
+    bool fg_known;
+    bool bg_known;
+    Color fg;
+    Color bg;
+    int length;
+    char out[TERMINAL_BUFFER_SIZE];
+    size_t bytes_written;
+} Terminal;
+
+static Terminal terminal;
+
+static inline bool color_eq(Color a, Color b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static void terminal_flush(void) {
+    fwrite(terminal.out, 1, terminal.length, stdout);
+    fflush(stdout);
+    terminal.bytes_written += terminal.length;
+    terminal.length = 0;
+}
+
+static void terminal_write(const char *format, ...) {
+    if (terminal.length > TERMINAL_BUFFER_SIZE - 64) {
+        terminal_flush();
+    }
+    va_list args;
+    va_start(args, format);
+    terminal.length += vsnprintf(terminal.out + terminal.length, TERMINAL_BUFFER_SIZE - terminal.length, format, args);
+    va_end(args);
+}
+
+static TerminalCell get_terminal_cell(FrameSnapshot *snapshot, int x, int y) {
+    return (TerminalCell) {
+        .glyph = ' ',
+        .bg = snapshot->tiles[x + (y * GAME_WIDTH)],
+    };
+}
+
+static void put_creature(FrameSnapshot *snapshot, TerminalCell cells[GAME_HEIGHT][GAME_WIDTH], CreatureSnapshot *c) {
+    Cell local = get_cell_local_position(snapshot, c->position);
+    if (local.x < 0 || local.x >= GAME_WIDTH || local.y < 0 || local.y >= GAME_HEIGHT) {
+        return;
+    }
+    TerminalCell *cell = &cells[local.y][local.x];
+    switch (c->type) {
+    case CREATURE_PLAYER: cell->glyph = '@'; cell->fg = COLOR_CREATURE_PLAYER; break;
+    case CREATURE_DIGGER: cell->glyph = 'd'; cell->fg = GREEN; break;
+    case CREATURE_EVIL_TRIANGLE: cell->glyph = 't'; cell->fg = COLOR_CREATURE_ENEMY; break;
+    case CREATURE_BIG_EVIL_TRIANGLE: cell->glyph = 'T'; cell->fg = COLOR_CREATURE_ENEMY2; break;
+    }
+}
+
+// blank cells do not care about the foreground, so only glyph cells compare it
+static inline bool terminal_cell_eq(TerminalCell a, TerminalCell b) {
+    if (a.glyph != b.glyph || !color_eq(a.bg, b.bg)) {
+        return false;
+    }
+    return a.glyph == ' ' || color_eq(a.fg, b.fg);
+}
+
+static void emit_cell(int x, int y, TerminalCell cell) {
+    if (terminal.cursor.x != x || terminal.cursor.y != y) {
+        terminal_write("\x1b[%d;%dH", y + 1, (x * 2) + 1);
+    }
+    if (!terminal.bg_known || !color_eq(terminal.bg, cell.bg)) {
+        terminal_write("\x1b[48;2;%d;%d;%dm", cell.bg.r, cell.bg.g, cell.bg.b);
+        terminal.bg = cell.bg;
+        terminal.bg_known = true;
+    }
+    if (cell.glyph != ' ' && (!terminal.fg_known || !color_eq(terminal.fg, cell.fg))) {
+        terminal_write("\x1b[38;2;%d;%d;%dm", cell.fg.r, cell.fg.g, cell.fg.b);
+        terminal.fg = cell.fg;
+        terminal.fg_known = true;
+    }
+    terminal_write("%c ", cell.glyph);
+    terminal.cursor = (Cell) { x + 1, y };
+}
+
+// the viewport follows the player, so after a step nearly every cell differs.
+// moving what is already on screen with the terminal's own scroll and
+// insert/delete character commands leaves only the uncovered edge to draw.
+// cells whose shadow is cleared to glyph 0 never compare equal
+static void scroll_terminal(Cell shift) {
+    TerminalCell blank = { 0 };
+    if (shift.y != 0) {
+        int n = abs(shift.y);
+        terminal_write("\x1b[%d%c", n, (shift.y > 0) ? 'S' : 'T');
+        if (shift.y > 0) {
+            memmove(&terminal.shadow[0], &terminal.shadow[n], (GAME_HEIGHT - n) * sizeof(terminal.shadow[0]));
+            for (int y = GAME_HEIGHT - n; y < GAME_HEIGHT; y++) {
+                for (int x = 0; x < GAME_WIDTH; x++) terminal.shadow[y][x] = blank;
+            }
+        } else {
+            memmove(&terminal.shadow[n], &terminal.shadow[0], (GAME_HEIGHT - n) * sizeof(terminal.shadow[0]));
+            for (int y = 0; y < n; y++) {
+                for (int x = 0; x < GAME_WIDTH; x++) terminal.shadow[y][x] = blank;
+            }
+        }
+    }
+    if (shift.x != 0) {
+        int n = abs(shift.x);
+        for (int y = 0; y < GAME_HEIGHT; y++) {
+            TerminalCell *row = terminal.shadow[y];
+            if (shift.x > 0) {
+                terminal_write("\x1b[%d;1H\x1b[%dP", y + 1, n * 2);
+                memmove(&row[0], &row[n], (GAME_WIDTH - n) * sizeof(TerminalCell));
+                for (int x = GAME_WIDTH - n; x < GAME_WIDTH; x++) row[x] = blank;
+            } else {
+                // drop what would be pushed past the viewport before inserting
+                terminal_write("\x1b[%d;%dH\x1b[%dP\x1b[1G\x1b[%d@", y + 1, ((GAME_WIDTH - n) * 2) + 1, n * 2, n * 2);
+                memmove(&row[n], &row[0], (GAME_WIDTH - n) * sizeof(TerminalCell));
+                for (int x = 0; x < n; x++) row[x] = blank;
+            }
+        }
+    }
+    terminal.cursor = INVALID_CELL;
+}
+
+// diffs the snapshot's viewport against the shadow and writes only what moved
+void draw_terminal(FrameSnapshot *snapshot) {
+    static TerminalCell cells[GAME_HEIGHT][GAME_WIDTH];
+    for (int y = 0; y < GAME_HEIGHT; y++) {
+        for (int x = 0; x < GAME_WIDTH; x++) {
+            cells[y][x] = get_terminal_cell(snapshot, x, y);
+        }
+    }
+    put_creature(snapshot, cells, &snapshot->player);
+    for (int i = 0; i < snapshot->creature_count; i++) {
+        put_creature(snapshot, cells, &snapshot->creatures[i]);
+    }
+
+    if (!terminal.valid) {
+        terminal_write("\x1b[0m\x1b[2J\x1b[?25l\x1b[1;%dr", GAME_HEIGHT);
+        terminal.cursor = INVALID_CELL;
+        terminal.fg_known = false;
+        terminal.bg_known = false;
+    } else {
+        Cell shift = cell_subtract(snapshot->game_offset, terminal.offset);
+        bool scrolled = (shift.x != 0 || shift.y != 0) && abs(shift.x) < GAME_WIDTH && abs(shift.y) < GAME_HEIGHT;
+        if (scrolled) {
+            scroll_terminal(shift);
+        }
+    }
+    terminal.offset = snapshot->game_offset;
+    for (int y = 0; y < GAME_HEIGHT; y++) {
+        for (int x = 0; x < GAME_WIDTH; x++) {
+            if (terminal.valid && terminal_cell_eq(terminal.shadow[y][x], cells[y][x])) {
+                continue;
+            }
+            emit_cell(x, y, cells[y][x]);
+            terminal.shadow[y][x] = cells[y][x];
+        }
+    }
+    terminal.valid = true;
+    terminal_flush();
+}
+
+static struct termios original_mode;
+
+// ctrl-c arrives as a key instead of a signal, so quitting with it still goes
+// through leave_raw_mode and the reset of the screen
+static void enter_raw_mode(void) {
+    tcgetattr(STDIN_FILENO, &original_mode);
+    struct termios raw = original_mode;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+}
+
+static void leave_raw_mode(void) {
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &original_mode);
+}
+
+// blocks for one key and turns it into a turn request, false on quit
+static bool read_command(SimCommand *command) {
+    char keys[8];
+    while (true) {
+        int count = read(STDIN_FILENO, keys, sizeof(keys));
+        if (count <= 0) {
+            return false;
+        }
+        char key = keys[0];
+        if (count >= 3 && keys[0] == '\x1b' && keys[1] == '[') {
+            switch (keys[2]) {
+            case 'A': key = 'w'; break;
+            case 'D': key = 'a'; break;
+            case 'B': key = 's'; break;
+            case 'C': key = 'd'; break;
+            }
+        }
+        *command = (SimCommand) { .action = TURN_ACTION_STEP };
+        switch (key) {
+        case 'w': case 'k': command->direction = ORTHAGONAL_N; return true;
+        case 'a': case 'h': command->direction = ORTHAGONAL_W; return true;
+        case 's': case 'j': command->direction = ORTHAGONAL_S; return true;
+        case 'd': case 'l': command->direction = ORTHAGONAL_E; return true;
+        case ' ': case '.': command->action = TURN_ACTION_WAIT; return true;
+        case 'u': command->action = TURN_ACTION_UNDO; return true;
+        case 'q': case '\x03': case '\x04': return false;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32 seed = 8;
+    int turns = -1;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = (uint32)strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--turns") == 0 && has_value) {
+            turns = atoi(argv[++i]);
+        } else {
+            printf("usage: terminal [--seed N] [--turns N]\n");
+            return 2;
+        }
+    }
+
+    State *state = (State *)calloc(1, sizeof(State));
+    FrameSnapshot *snapshot = (FrameSnapshot *)calloc(1, sizeof(FrameSnapshot));
+    init_game(state, seed, WORKER_COUNT);
+    state->mouse_current = state->player.position;
+    capture_snapshot(state, snapshot, 0, 0);
+    draw_terminal(snapshot);
+    size_t first_frame_bytes = terminal.bytes_written;
+
+    // there is no turn animation here, so creatures that left the field of
+    // view are hidden as soon as the turn is done
+    bool interactive = turns < 0;
+    if (interactive) {
+        enter_raw_mode();
+    }
+    int turns_played = 0;
+    SimCommand command = { .action = TURN_ACTION_WAIT };
+    while (interactive ? read_command(&command) : turns_played < turns) {
+        run_turn(state, &command);
+        hide_unseen_creatures(state);
+        state->mouse_current = state->player.position;
+        capture_snapshot(state, snapshot, 0, 0);
+        draw_terminal(snapshot);
+        turns_played++;
+    }
+    if (interactive) {
+        leave_raw_mode();
+    }
+
+    terminal_write("\x1b[0m\x1b[r\x1b[%d;1H\x1b[?25h", GAME_HEIGHT + 1);
+    terminal_flush();
+    if (turns_played > 0) {
+        fprintf(stderr, "first frame %zu bytes, %.1f bytes per turn over %d turns\n",
+            first_frame_bytes,
+            (double)(terminal.bytes_written - first_frame_bytes) / turns_played,
+            turns_played
+        );
+    }
+
+    deinit_game(state);
+    free(snapshot);
+    free(state);
+    return 0;
+}
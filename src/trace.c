@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "main.h"
+
+// every event claims its slot with one atomic add, recording never locks or
+// allocates. once the buffer is full the rest is dropped and counted. the
+// file is written after every other thread stopped, as chrome trace json.
+// built only with -DTRACE
+
+#if TRACE
+
+static struct {
+    TraceEvent *events;
+    uint64 count;
+    double origin;
+    bool recording;
+    uint16 thread_count;
+    const char *thread_names[TRACE_THREADS];
+} tracer;
+
+static __thread uint16 trace_thread_id;
+
+static uint16 get_trace_thread(void) {
+    if (trace_thread_id == 0) {
+        trace_thread_id = __atomic_add_fetch(&tracer.thread_count, 1, __ATOMIC_RELAXED);
+    }
+    return trace_thread_id;
+}
+
+// names the calling thread in the viewer, works before trace_start too
+void trace_thread(const char *name) {
+    uint16 thread = get_trace_thread();
+    if (thread < TRACE_THREADS) {
+        tracer.thread_names[thread] = name;
+    }
+}
+
+void trace_event(const char *name, char phase, const char *arg_name, int arg) {
+    if (!__atomic_load_n(&tracer.recording, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    uint64 slot = __atomic_fetch_add(&tracer.count, 1, __ATOMIC_RELAXED);
+    if (slot >= TRACE_CAPACITY) {
+        return;
+    }
+    TraceEvent *e = &tracer.events[slot];
+    e->name = name;
+    e->arg_name = arg_name;
+    e->time_us = (get_time_ms() - tracer.origin) * 1000.0;
+    e->arg = arg;
+    e->thread = get_trace_thread();
+    e->phase = phase;
+}
+
+void trace_start(void) {
+    tracer.events = (TraceEvent *)malloc(TRACE_CAPACITY * sizeof(TraceEvent));
+    tracer.count = 0;
+    tracer.origin = get_time_ms();
+    trace_thread("main");
+    __atomic_store_n(&tracer.recording, true, __ATOMIC_RELEASE);
+}
+
+// writes the events to path and frees them. call it once the threads that
+// record are joined, an event still being written would be torn
+bool trace_stop(const char *path) {
+    if (!tracer.events) {
+        return true;
+    }
+    __atomic_store_n(&tracer.recording, false, __ATOMIC_RELEASE);
+    uint64 count = (tracer.count < TRACE_CAPACITY) ? tracer.count : TRACE_CAPACITY;
+    FILE *file = fopen(path, "w");
+    if (file) {
+        fprintf(file, "{\"traceEvents\":[\n");
+        int threads = (tracer.thread_count < TRACE_THREADS) ? tracer.thread_count + 1 : TRACE_THREADS;
+        for (int thread = 1; thread < threads; thread++) {
+            const char *name = tracer.thread_names[thread] ? tracer.thread_names[thread] : "thread";
+            fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                thread, name
+            );
+        }
+        for (uint64 i = 0; i < count; i++) {
+            TraceEvent *e = &tracer.events[i];
+            fprintf(file, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+                e->name, e->phase, e->time_us, e->thread
+            );
+            if (e->arg_name) {
+                fprintf(file, ",\"args\":{\"%s\":%d}", e->arg_name, e->arg);
+            }
+            fprintf(file, "},\n");
+        }
+        fprintf(file, "{\"name\":\"dropped\",\"ph\":\"i\",\"s\":\"g\",\"ts\":0,\"pid\":1,\"tid\":1,\"args\":{\"events\":%llu}}\n",
+            (unsigned long long)(tracer.count - count)
+        );
+        fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+    }
+    bool written = file && fclose(file) == 0;
+    free(tracer.events);
+    tracer.events = 0;
+    return written;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#include <string.h>
+#include "main.h"
+
+// every turn saves what it is about to overwrite: cells through write_cell,
+// creatures through save_creature_for_undo, and the few scalars and schedule
+// slots when it begins. changes between turns, like hiding creatures after
+// the animation, belong to the turn before. undoing walks one turn's entries
+// backwards, so it costs as much as the turn changed
+
+// moves first_turn past every turn whose record or entries were overwritten.
+// it never moves back, the counts shrinking again after an undo does not
+// bring the overwritten entries back
+static void drop_overwritten_turns(UndoLog *u) {
+    while (u->first_turn < u->turn_count) {
+        UndoTurn *turn = &u->turns[u->first_turn % UNDO_TURN_CAPACITY];
+        bool kept = (
+            u->turn_count - u->first_turn <= UNDO_TURN_CAPACITY &&
+            u->cell_count - turn->cell_start <= UNDO_CELL_CAPACITY &&
+            u->creature_count - turn->creature_start <= UNDO_CREATURE_CAPACITY
+        );
+        if (kept) {
+            return;
+        }
+        u->first_turn++;
+    }
+}
+
+// slot is an index in creatures or HASH_SLOT_PLAYER
+void save_creature_for_undo(State *state, int slot) {
+    UndoLog *u = &state->undo;
+    if (u->turn_count == 0 || u->restoring || u->creature_stamps[slot] == u->turn_count) {
+        return;
+    }
+    u->creature_stamps[slot] = u->turn_count;
+    UndoCreature *entry = &u->creatures[u->creature_count++ % UNDO_CREATURE_CAPACITY];
+    entry->slot = slot;
+    if (slot == HASH_SLOT_PLAYER) {
+        entry->creature = state->player;
+        entry->scheduled = false;
+        return;
+    }
+    Schedule *s = &state->schedule;
+    entry->creature = state->creatures[slot];
+    entry->scheduled = s->scheduled[slot];
+    entry->action_time = s->action_time[slot];
+    entry->next = s->next[slot];
+}
+
+// drops the saved cells the open turn ended up not changing, a step clears
+// and sets visibility on the whole viewport but only its edges move
+static void compact_undo_turn(State *state) {
+    UndoLog *u = &state->undo;
+    uint32 t = u->turn_count - 1;
+    if (t < u->first_turn) {
+        return;
+    }
+    uint32 kept = u->turns[t % UNDO_TURN_CAPACITY].cell_start;
+    for (uint32 i = kept; i < u->cell_count; i++) {
+        UndoCell cell = u->cells[i % UNDO_CELL_CAPACITY];
+        if (state->grid[cell.x][cell.y] != cell.flags) {
+            u->cells[kept++ % UNDO_CELL_CAPACITY] = cell;
+        } else {
+            u->cell_stamps[cell.x][cell.y] = 0;
+        }
+    }
+    u->cell_count = kept;
+}
+
+// closes the open turn and opens the next, called before a turn changes anything
+void begin_undo_turn(State *state) {
+    UndoLog *u = &state->undo;
+    drop_overwritten_turns(u);
+    if (u->turn_count > 0) {
+        compact_undo_turn(state);
+    }
+    uint32 t = u->turn_count++;
+    drop_overwritten_turns(u);
+    UndoTurn *turn = &u->turns[t % UNDO_TURN_CAPACITY];
+    turn->cell_start = u->cell_count;
+    turn->creature_start = u->creature_count;
+    turn->random = state->random;
+    turn->turn = state->turn;
+    turn->now = state->schedule.now;
+    turn->flags = state->flags;
+    turn->mouse_target = state->mouse_target;
+    turn->game_offset = state->game_offset;
+    memcpy(turn->slots, state->schedule.slots, sizeof(turn->slots));
+}
+
+// makes every turn so far permanent, for when they changed a grid that is
+// not there anymore
+void forget_undo_turns(UndoLog *u) {
+    u->first_turn = u->turn_count;
+}
+
+static void restore_creature(State *state, UndoCreature *entry) {
+    if (entry->slot == HASH_SLOT_PLAYER) {
+        state->player = entry->creature;
+    } else {
+        int idx = entry->slot;
+        Creature *c = &state->creatures[idx];
+        int chunk = get_chunk(c->position);
+        *c = entry->creature;
+        if (get_chunk(c->position) != chunk) {
+            unlink_creature_from_chunk(state, idx, chunk);
+            link_creature_to_chunk(state, idx);
+        }
+        Schedule *s = &state->schedule;
+        s->scheduled[idx] = entry->scheduled;
+        s->action_time[idx] = entry->action_time;
+        s->next[idx] = entry->next;
+    }
+    state->undo.creature_stamps[entry->slot] = 0;
+    rehash_creature(state, entry->slot);
+}
+
+// puts the game back to where it was before the most recent turn. false when
+// there is no turn left that can be undone. plans are not saved, creatures
+// plan afresh like after loading a level
+bool undo_turn(State *state) {
+    UndoLog *u = &state->undo;
+    drop_overwritten_turns(u);
+    if (u->turn_count == 0 || u->turn_count - 1 < u->first_turn) {
+        return false;
+    }
+    UndoTurn *turn = &u->turns[(u->turn_count - 1) % UNDO_TURN_CAPACITY];
+    u->restoring = true;
+    while (u->cell_count > turn->cell_start) {
+        UndoCell *cell = &u->cells[--u->cell_count % UNDO_CELL_CAPACITY];
+        write_cell(state, (Cell) { cell->x, cell->y }, cell->flags);
+        u->cell_stamps[cell->x][cell->y] = 0;
+    }
+    while (u->creature_count > turn->creature_start) {
+        restore_creature(state, &u->creatures[--u->creature_count % UNDO_CREATURE_CAPACITY]);
+    }
+    u->restoring = false;
+
+    state->random = turn->random;
+    state->turn = turn->turn;
+    state->schedule.now = turn->now;
+    state->flags = turn->flags;
+    state->mouse_target = turn->mouse_target;
+    state->game_offset = turn->game_offset;
+    memcpy(state->schedule.slots, turn->slots, sizeof(turn->slots));
+    reset_cooperative_paths(state);
+    u->turn_count--;
+    return true;
+}
@@ -10,9 +10,9 @@ void bresenham(State *state, Cell start, Cell end) {
         if (is_cell_out_of_bounds(state, ray_cell)) {
             break;
         }
-        uint8 *flags = &state->grid[ray_cell.x][ray_cell.y];
-        *flags |= (CELL_FLAG_DISCOVERED | CELL_FLAG_VISIBLE);
-        if (has_flag(*flags, CELL_FLAG_WALL)) {
+        add_cell_flags(state, ray_cell, CELL_FLAG_DISCOVERED | CELL_FLAG_VISIBLE);
+        COUNT_WORK(FOV_CELLS, 1);
+        if (has_flag(state->grid[ray_cell.x][ray_cell.y], CELL_FLAG_WALL)) {
             break;
         }
         if (start.x == end.x && start.y == end.y) break;
@@ -23,6 +23,8 @@ void bresenham(State *state, Cell start, Cell end) {
 }
 
 void set_invisible(State *state) {
+    PROFILE_BEGIN(VISION);
+    TRACE_BEGIN("set invisible");
     int game_right = state->game_offset.x + GAME_WIDTH;
     int game_bottom = state->game_offset.y + GAME_HEIGHT;
     for (int x = state->game_offset.x; x < game_right; x++) {
@@ -31,12 +33,16 @@ void set_invisible(State *state) {
             if (is_cell_out_of_bounds(state, cell)) {
                 continue;
             }
-            state->grid[x][y] &= ~CELL_FLAG_VISIBLE;
+            remove_cell_flags(state, cell, CELL_FLAG_VISIBLE);
         }
     }
+    TRACE_END("set invisible");
+    PROFILE_END(VISION);
 }
 
 void discover_visible_cells(State *state) {
+    PROFILE_BEGIN(VISION);
+    TRACE_BEGIN("fov");
     Cell player = {
         state->player.position.x,
         state->player.position.y,
@@ -68,4 +74,6 @@ void discover_visible_cells(State *state) {
         Cell last_cell_in_column = { x, y_end - 1 };
         bresenham(state, player, last_cell_in_column);
     }
+    TRACE_END("fov");
+    PROFILE_END(VISION);
 }
@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include "main.h"
+
+// totals since the last reset. the workers add to them too, so the adds are
+// atomic, and the sums come out the same whichever thread did the work.
+// built only with -DCOUNTERS
+
+#if COUNTERS
+
+static uint64 work_counters[WORK_COUNTER_COUNT];
+
+static const char *work_counter_names[WORK_COUNTER_COUNT] = {
+    [WORK_COUNTER_ASTAR_EXPANSIONS] = "astar_expansions",
+    [WORK_COUNTER_BFS_CELLS] = "bfs_cells",
+    [WORK_COUNTER_FOV_CELLS] = "fov_cells",
+    [WORK_COUNTER_CELL_VALID] = "cell_valid_calls",
+    [WORK_COUNTER_MAPGEN_PROBES] = "mapgen_probes",
+    [WORK_COUNTER_DRAW_CALLS] = "draw_calls",
+};
+
+const char *get_work_counter_name(WorkCounter counter) {
+    return work_counter_names[counter];
+}
+
+void count_work(WorkCounter counter, int amount) {
+    __atomic_fetch_add(&work_counters[counter], (uint64)amount, __ATOMIC_RELAXED);
+}
+
+uint64 get_work_counter(WorkCounter counter) {
+    return __atomic_load_n(&work_counters[counter], __ATOMIC_RELAXED);
+}
+
+void reset_work_counters(void) {
+    for (int counter = 0; counter < WORK_COUNTER_COUNT; counter++) {
+        __atomic_store_n(&work_counters[counter], 0, __ATOMIC_RELAXED);
+    }
+}
+
+void print_work_counters(void) {
+    for (int counter = 0; counter < WORK_COUNTER_COUNT; counter++) {
+        printf("%-17s %llu\n", work_counter_names[counter], (unsigned long long)get_work_counter(counter));
+    }
+}
+
+#endif
@@ -0,0 +1,317 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#if !COUNTERS
+#error "workload needs -DCOUNTERS, build it with workload.sh"
+#endif
+
+#include "main.h"
+#include "map.c"
+#include "vision.c"
+#include "movement.c"
+#include "jobs.c"
+#include "schedule.c"
+#include "cooperative.c"
+#include "creatures.c"
+#include "undo.c"
+#include "hash.c"
+#include "game.c"
+#include "level.c"
+#include "levels.c"
+#include "platform.c"
+#include "profile.c"
+#include "trace.c"
+#include "work.c"
+#include "world.c"
+#include "autosave.c"
+#include "replay.c"
+#include "sim.c"
+#include "raster.c"
+#include "backend_software.c"
+#include "sprites.c"
+#include "renderer.c"
+
+// plays fixed scenarios from their seeds and totals the work counters of
+// each. the same code does the same work on any machine, so the totals are
+// compared exactly against a committed baseline, a higher one fails
+//
+//   workload                            prints the totals
+//   workload --baseline workload.txt    compares them, exit 1 when one grew
+//   workload --save workload.txt        writes them as the new baseline
+
+#define WORKLOAD_NAME_CAPACITY 32
+
+typedef enum ScenarioKind {
+    SCENARIO_CHASE,
+    SCENARIO_EXPLORE,
+} ScenarioKind;
+
+// levels are generated on their own besides the one the game starts on, a
+// frame is rendered every frame_interval turns
+typedef struct Scenario {
+    const char *name;
+    uint32 seed;
+    ScenarioKind kind;
+    int levels;
+    int turns;
+    int frame_interval;
+    bool map_view;
+} Scenario;
+
+static const Scenario scenarios[] = {
+    { "chase", 8, SCENARIO_CHASE, 2, 200, 10, false },
+    { "explore", 3, SCENARIO_EXPLORE, 2, 300, 5, false },
+    { "explore_map", 1234, SCENARIO_EXPLORE, 4, 300, 25, true },
+};
+
+#define SCENARIO_COUNT ((int)(sizeof(scenarios) / sizeof(scenarios[0])))
+
+typedef struct ScenarioTotals {
+    int frames;
+    uint64 counters[WORK_COUNTER_COUNT];
+} ScenarioTotals;
+
+// the level below is generated in the background, its work has to be done
+// before the counters are read or reset for the totals to be exact
+static void wait_for_generator(LevelGenerator *g) {
+    if (!g->running) {
+        return;
+    }
+    pthread_mutex_lock(&g->mutex);
+    while (!g->done) {
+        pthread_cond_wait(&g->wake, &g->mutex);
+    }
+    pthread_mutex_unlock(&g->mutex);
+}
+
+// a discovered walkable cell in the viewport, the player's position when the
+// draws find none
+static Cell pick_explore_target(State *state, uint32 *random) {
+    for (int i = 0; i < 64; i++) {
+        Cell cell = {
+            state->game_offset.x + random_range(random, 0, GAME_WIDTH - 1),
+            state->game_offset.y + random_range(random, 0, GAME_HEIGHT - 1),
+        };
+        if (!is_cell_out_of_bounds(state, cell) && has_flag(state->grid[cell.x][cell.y], CELL_FLAG_PLAYER_WALKABLE)) {
+            return cell;
+        }
+    }
+    return state->player.position;
+}
+
+// of a few explore targets the one closest to a creature, so the player walks
+// up to the creatures and they wake up and chase it
+static Cell pick_chase_target(State *state, uint32 *random) {
+    Cell best = state->player.position;
+    int best_distance = INT_MAX;
+    for (int draw = 0; draw < 8; draw++) {
+        Cell cell = pick_explore_target(state, random);
+        for (int i = 0; i < CREATURE_CAPACITY; i++) {
+            int distance = manhattan_distance(cell, state->creatures[i].position);
+            if (distance < best_distance) {
+                best = cell;
+                best_distance = distance;
+            }
+        }
+    }
+    return best;
+}
+
+static void draw_scenario_frame(State *state, FrameSnapshot *snapshot, bool map_view) {
+    hide_unseen_creatures(state);
+    state->mouse_current = state->player.position;
+    capture_snapshot(state, snapshot, 0, 0);
+    state->frame.valid = false;
+    if (map_view) {
+        draw_map_only(state, snapshot);
+    } else {
+        render(state, snapshot);
+    }
+}
+
+static ScenarioTotals run_scenario(const Scenario *scenario, int worker_count) {
+    ScenarioTotals totals = { 0 };
+    State *state = (State *)calloc(1, sizeof(State));
+    init_game(state, scenario->seed, worker_count);
+    state->turn_time = CELLSIZE;
+    wait_for_generator(&state->generator);
+    reset_work_counters();
+
+    LevelGen *gen = (LevelGen *)calloc(1, sizeof(LevelGen));
+    gen->grid = (Grid)malloc(GRID_BYTES);
+    for (int depth = 0; depth < scenario->levels; depth++) {
+        generate_level(gen, scenario->seed, depth);
+    }
+    free(gen->grid);
+    free(gen);
+
+    FrameSnapshot *snapshot = (FrameSnapshot *)calloc(1, sizeof(FrameSnapshot));
+    uint32 random = scenario->seed | 1;
+    for (int turn = 0; turn < scenario->turns; turn++) {
+        hide_unseen_creatures(state);
+        SimCommand command = { .action = TURN_ACTION_CONTINUE };
+        if (!has_flag(state->flags, GAME_FLAG_IS_MOVING)) {
+            command.action = TURN_ACTION_CLICK;
+            command.target = (scenario->kind == SCENARIO_CHASE)
+                ? pick_chase_target(state, &random)
+                : pick_explore_target(state, &random);
+        }
+        run_turn(state, &command);
+        if ((turn + 1) % scenario->frame_interval == 0) {
+            draw_scenario_frame(state, snapshot, scenario->map_view);
+            totals.frames++;
+        }
+    }
+
+    wait_for_generator(&state->generator);
+    for (int counter = 0; counter < WORK_COUNTER_COUNT; counter++) {
+        totals.counters[counter] = get_work_counter(counter);
+    }
+
+    if (state->tiles.loaded) {
+        gfx_unload_image(state->tiles.image);
+    }
+    unload_sprite_atlas(&state->sprites);
+    unload_map_overview(&state->overview);
+    unload_frame_cache(&state->frame);
+    free(snapshot);
+    deinit_game(state);
+    free(state);
+    return totals;
+}
+
+static bool save_baseline(const char *path, ScenarioTotals *totals) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "# scenario counter total, written by workload --save\n");
+    for (int i = 0; i < SCENARIO_COUNT; i++) {
+        for (int counter = 0; counter < WORK_COUNTER_COUNT; counter++) {
+            fprintf(file, "%s %s %llu\n",
+                scenarios[i].name, get_work_counter_name(counter), (unsigned long long)totals[i].counters[counter]
+            );
+        }
+    }
+    return fclose(file) == 0;
+}
+
+// prints every total that differs from the baseline. returns how many grew or
+// are missing from it, -1 when the file cannot be read
+static int compare_baseline(const char *path, ScenarioTotals *totals) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    bool found[SCENARIO_COUNT][WORK_COUNTER_COUNT] = { 0 };
+    int failures = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        char scenario_name[WORKLOAD_NAME_CAPACITY];
+        char counter_name[WORKLOAD_NAME_CAPACITY];
+        unsigned long long expected;
+        if (line[0] == '#' || sscanf(line, "%31s %31s %llu", scenario_name, counter_name, &expected) != 3) {
+            continue;
+        }
+        for (int i = 0; i < SCENARIO_COUNT; i++) {
+            for (int counter = 0; counter < WORK_COUNTER_COUNT; counter++) {
+                if (strcmp(scenario_name, scenarios[i].name) != 0 || strcmp(counter_name, get_work_counter_name(counter)) != 0) {
+                    continue;
+                }
+                found[i][counter] = true;
+                unsigned long long actual = totals[i].counters[counter];
+                if (actual == expected) {
+                    continue;
+                }
+                bool grew = actual > expected;
+                failures += grew;
+                printf("%s %s: %llu, baseline %llu (%+.2f%%)%s\n",
+                    scenario_name, counter_name, actual, expected,
+                    (expected > 0) ? (((double)actual / expected) - 1.0) * 100.0 : 100.0,
+                    grew ? "  GREW" : ", lower, update the baseline"
+                );
+            }
+        }
+    }
+    fclose(file);
+    for (int i = 0; i < SCENARIO_COUNT; i++) {
+        for (int counter = 0; counter < WORK_COUNTER_COUNT; counter++) {
+            if (!found[i][counter]) {
+                printf("%s %s: missing from the baseline\n", scenarios[i].name, get_work_counter_name(counter));
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+static void usage(void) {
+    printf(
+        "usage: workload [options]\n"
+        "  --baseline FILE  compare the totals, exit 1 when one grew or is missing\n"
+        "  --save FILE      write the totals as a baseline\n"
+        "  --workers N      threads for the creatures, the totals do not depend on it\n"
+    );
+}
+
+int main(int argc, char **argv) {
+    const char *save_path = 0;
+    const char *baseline_path = 0;
+    int worker_count = WORKER_COUNT;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--save") == 0 && has_value) {
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && has_value) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && has_value) {
+            worker_count = atoi(argv[++i]);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    software_init(CELLSIZE * GAME_WIDTH, CELLSIZE * GAME_HEIGHT);
+    ScenarioTotals totals[SCENARIO_COUNT];
+    printf("%-12s %6s", "scenario", "frames");
+    for (int counter = 0; counter < WORK_COUNTER_COUNT; counter++) {
+        printf(" %17s", get_work_counter_name(counter));
+    }
+    printf(" %10s\n", "draws/frame");
+    for (int i = 0; i < SCENARIO_COUNT; i++) {
+        totals[i] = run_scenario(&scenarios[i], worker_count);
+        printf("%-12s %6d", scenarios[i].name, totals[i].frames);
+        for (int counter = 0; counter < WORK_COUNTER_COUNT; counter++) {
+            printf(" %17llu", (unsigned long long)totals[i].counters[counter]);
+        }
+        printf(" %10.1f\n", (totals[i].frames > 0)
+            ? (double)totals[i].counters[WORK_COUNTER_DRAW_CALLS] / totals[i].frames
+            : 0.0
+        );
+    }
+    software_deinit();
+
+    int result = 0;
+    if (save_path && !save_baseline(save_path, totals)) {
+        printf("could not write %s\n", save_path);
+        result = 2;
+    }
+    if (baseline_path) {
+        int failures = compare_baseline(baseline_path, totals);
+        if (failures < 0) {
+            printf("could not read %s\n", baseline_path);
+            result = 2;
+        } else if (failures > 0) {
+            printf("%d totals grew or are missing from %s\n", failures, baseline_path);
+            result = 1;
+        } else {
+            printf("every total is within %s\n", baseline_path);
+        }
+    }
+    return result;
+}
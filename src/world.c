@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+
+// a world file is the level split so it can be mapped instead of decoded.
+// grid chunks are stored uncompressed at fixed offsets, so reaching one is
+// pointer arithmetic and the pages of chunks nobody comes near are never read
+//
+//   page 0        header: magic, version, grid and chunk size, offsets
+//   state         the level state section as in level.c, whole pages
+//   index         one byte per chunk, every flag used in the chunk
+//   chunks        WORLD_CHUNK_BYTES per chunk, rows of CHUNK_SIZE cells
+
+#define WORLD_MAGIC 0x444c5257u
+#define WORLD_VERSION 2
+#define WORLD_HEADER_BYTES 40
+
+typedef struct WorldLayout {
+    size_t state_offset;
+    size_t state_size;
+    size_t index_offset;
+    size_t chunks_offset;
+    size_t size;
+} WorldLayout;
+
+static inline size_t align_to_page(size_t size) {
+    return (size + WORLD_PAGE_SIZE - 1) & ~(size_t)(WORLD_PAGE_SIZE - 1);
+}
+
+static WorldLayout get_world_layout(void) {
+    WorldLayout layout;
+    layout.state_offset = WORLD_PAGE_SIZE;
+    layout.state_size = align_to_page(get_level_state_bound());
+    layout.index_offset = layout.state_offset + layout.state_size;
+    layout.chunks_offset = align_to_page(layout.index_offset + CHUNK_AMOUNT);
+    layout.size = layout.chunks_offset + (CHUNK_AMOUNT * WORLD_CHUNK_BYTES);
+    return layout;
+}
+
+static inline Cell get_chunk_origin(int chunk) {
+    return (Cell) { (chunk % CHUNK_COLUMNS) * CHUNK_SIZE, (chunk / CHUNK_COLUMNS) * CHUNK_SIZE };
+}
+
+// copies a chunk from the file into the grid, the grid is still empty there
+static void page_in_chunk(State *state, int chunk) {
+    World *world = &state->world;
+    if (world->resident[chunk]) {
+        return;
+    }
+    Cell origin = get_chunk_origin(chunk);
+    uint8 *source = world->chunks + (chunk * WORLD_CHUNK_BYTES);
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            Cell cell = { origin.x + x, origin.y + y };
+            uint8 flags = source[x + (y * CHUNK_SIZE)];
+            state->grid[cell.x][cell.y] = flags;
+            state->hash.grid ^= cell_hash_key(cell, flags);
+        }
+    }
+    world->resident[chunk] = true;
+    world->dirty[chunk] = false;
+
+    // the masks along the border look into the neighbouring chunks
+    Cell min = { origin.x - 1, origin.y - 1 };
+    Cell max = { origin.x + CHUNK_SIZE + 1, origin.y + CHUNK_SIZE + 1 };
+    build_neighbour_masks_in(state,
+        (Cell) { (min.x > 0) ? min.x : 0, (min.y > 0) ? min.y : 0 },
+        (Cell) { (max.x < GRID_WIDTH) ? max.x : GRID_WIDTH, (max.y < GRID_HEIGHT) ? max.y : GRID_HEIGHT }
+    );
+    state->chunk_versions[chunk]++;
+    state->grid_version++;
+    // the chasers' distance field does not reach into the new cells yet
+    state->space_time.distance_goal = INVALID_CELL;
+}
+
+static void store_chunk(State *state, int chunk) {
+    World *world = &state->world;
+    Cell origin = get_chunk_origin(chunk);
+    uint8 *target = world->chunks + (chunk * WORLD_CHUNK_BYTES);
+    uint8 used = 0;
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            uint8 flags = state->grid[origin.x + x][origin.y + y];
+            target[x + (y * CHUNK_SIZE)] = flags;
+            used |= flags;
+        }
+    }
+    world->index[chunk] = used;
+    world->dirty[chunk] = false;
+}
+
+// brings in every chunk a creature could be simulated in, see wake_nearby_creatures
+void page_in_world(State *state) {
+    if (!state->world.open) {
+        return;
+    }
+    Cell min, max;
+    get_viewport_chunks(state, LOD_COARSE_MARGIN, &min, &max);
+    for (int cy = min.y; cy < max.y; cy++) {
+        for (int cx = min.x; cx < max.x; cx++) {
+            page_in_chunk(state, cx + (cy * CHUNK_COLUMNS));
+        }
+    }
+}
+
+// copies the chunks the grid changed into the mapping, the system writes
+// those pages back to the file on its own time
+void store_world(State *state) {
+    World *world = &state->world;
+    if (!world->open) {
+        return;
+    }
+    for (int i = 0; i < CHUNK_AMOUNT; i++) {
+        if (world->dirty[i] && world->resident[i]) {
+            store_chunk(state, i);
+        }
+    }
+}
+
+static bool store_world_state(State *state) {
+    BitStream *s = (BitStream *)malloc(sizeof(BitStream));
+    Level *level = (Level *)malloc(sizeof(Level));
+    capture_level_state(state, level);
+    open_memory_bit_stream(s, state->world.state, state->world.state_size);
+    put_level_state(s, level);
+    finish_bit_stream(s);
+    bool ok = !s->failed;
+    free(level);
+    free(s);
+    return ok;
+}
+
+static void attach_world(World *world, WorldLayout *layout) {
+    world->open = true;
+    world->state = world->file.data + layout->state_offset;
+    world->state_size = layout->state_size;
+    world->index = world->file.data + layout->index_offset;
+    world->chunks = world->file.data + layout->chunks_offset;
+}
+
+// writes the level of a game that is fully in memory as a world file and
+// keeps it open, every chunk is resident already
+bool create_world(State *state, const char *path) {
+    WorldLayout layout = get_world_layout();
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fseek(file, layout.size - 1, SEEK_SET) == 0 && fputc(0, file) != EOF;
+    ok = (fclose(file) == 0) && ok;
+
+    World *world = &state->world;
+    if (!ok || !map_file(&world->file, path)) {
+        return false;
+    }
+    BitStream *s = (BitStream *)malloc(sizeof(BitStream));
+    open_memory_bit_stream(s, world->file.data, WORLD_HEADER_BYTES);
+    put_bits(s, WORLD_MAGIC, 32);
+    put_bits(s, WORLD_VERSION, 32);
+    put_bits(s, GRID_WIDTH, 16);
+    put_bits(s, GRID_HEIGHT, 16);
+    put_bits(s, CHUNK_SIZE, 16);
+    put_bits(s, CREATURE_CAPACITY, 16);
+    put_bits(s, layout.state_offset, 32);
+    put_bits(s, layout.state_size, 32);
+    put_bits(s, layout.index_offset, 32);
+    put_bits(s, layout.chunks_offset, 32);
+    put_bits(s, layout.size, 32);
+    finish_bit_stream(s);
+    free(s);
+
+    attach_world(world, &layout);
+    for (int i = 0; i < CHUNK_AMOUNT; i++) {
+        world->resident[i] = true;
+        store_chunk(state, i);
+    }
+    return store_world_state(state);
+}
+
+// starts a game from a world file instead of init_game. only the header, the
+// level state and the chunks around the player are read here, so the time it
+// takes does not grow with the world. chunks with discovered cells come in
+// too since the map view shows them
+bool open_world(State *state, const char *path, int worker_count) {
+    World *world = &state->world;
+    if (!map_file(&world->file, path)) {
+        return false;
+    }
+    WorldLayout layout = get_world_layout();
+    BitStream *s = (BitStream *)malloc(sizeof(BitStream));
+    Level *level = (Level *)malloc(sizeof(Level));
+    open_memory_bit_stream(s, world->file.data, WORLD_HEADER_BYTES);
+    bool ok = (
+        world->file.size >= layout.size &&
+        get_bits(s, 32) == WORLD_MAGIC &&
+        get_bits(s, 32) == WORLD_VERSION &&
+        get_bits(s, 16) == GRID_WIDTH &&
+        get_bits(s, 16) == GRID_HEIGHT &&
+        get_bits(s, 16) == CHUNK_SIZE &&
+        get_bits(s, 16) == CREATURE_CAPACITY &&
+        get_bits(s, 32) == layout.state_offset &&
+        get_bits(s, 32) == layout.state_size &&
+        get_bits(s, 32) == layout.index_offset &&
+        get_bits(s, 32) == layout.chunks_offset
+    );
+    if (ok) {
+        open_memory_bit_stream(s, world->file.data + layout.state_offset, layout.state_size);
+        ok = get_level_state(s, state, level);
+    }
+    free(s);
+    if (!ok) {
+        free(level);
+        unmap_file(&world->file);
+        return false;
+    }
+
+    init_movement_tables();
+    apply_level_state(state, level);
+    free(level);
+    state->grid = (Grid)calloc(1, GRID_BYTES);
+    memset(state->neighbours, 0, sizeof(state->neighbours));
+    attach_world(world, &layout);
+    for (int i = 0; i < CHUNK_AMOUNT; i++) {
+        world->resident[i] = false;
+    }
+    reset_state_hash(state);
+
+    for (int i = 0; i < CHUNK_AMOUNT; i++) {
+        if (has_flag(world->index[i], CELL_FLAG_DISCOVERED)) {
+            page_in_chunk(state, i);
+        }
+    }
+    update_game_offset(state);
+    page_in_world(state);
+
+    init_creature_chunks(state);
+    reset_cooperative_paths(state);
+    workers_init(&state->workers, worker_count);
+    return true;
+}
+
+// writes back what changed, including the creatures, and unmaps the file
+bool close_world(State *state) {
+    World *world = &state->world;
+    if (!world->open) {
+        return true;
+    }
+    store_world(state);
+    bool ok = store_world_state(state);
+    unmap_file(&world->file);
+    world->open = false;
+    return ok;
+}
+
+// opens path when it exists, otherwise generates a game from seed and
+// creates the world file from it. false when an existing file is unusable
+bool open_or_create_world(State *state, const char *path, uint32 seed, int worker_count) {
+    FILE *existing = fopen(path, "rb");
+    if (existing) {
+        fclose(existing);
+        return open_world(state, path, worker_count);
+    }
+    init_game(state, seed, worker_count);
+    return create_world(state, path);
+}
@@ -0,0 +1,17 @@
+#!/bin/sh
+# builds the ansi terminal frontend (posix only, no raylib library needed)
+# and runs it with the given arguments, e.g. ./terminal.sh --seed 8
+
+mkdir -p ./build
+
+gcc \
+    -o ./build/terminal \
+    ./src/terminal.c \
+    -O2 \
+    -std=c99 \
+    -Wall \
+    -I./raylib/include/ \
+    -lm \
+    -lpthread || { echo "compilation of terminal failed"; exit 1; }
+
+./build/terminal "$@"
@@ -0,0 +1,18 @@
+#!/bin/sh
+# builds the work counter scenarios (posix only, no raylib library needed) and
+# runs them with the given arguments, e.g. ./workload.sh --baseline workload.txt
+
+mkdir -p ./build
+
+gcc \
+    -o ./build/workload \
+    ./src/workload.c \
+    -DCOUNTERS \
+    -O2 \
+    -std=c99 \
+    -Wall \
+    -I./raylib/include/ \
+    -lm \
+    -lpthread || { echo "compilation of workload failed"; exit 1; }
+
+./build/workload "$@"